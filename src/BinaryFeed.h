@@ -0,0 +1,127 @@
+#ifndef BINARYFEED_H
+#define BINARYFEED_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+
+#include "Enums.h"
+#include "Exceptions.h"
+#include "Parser.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary feeds are little endian, and read and written as they are"
+#endif
+
+namespace mvs {
+namespace orderbook {
+
+// one message in a binary feed. The fields are the same as in a text line,
+// only there's nothing to parse - a mapped feed file is just an array of
+// these, behind a FeedHeader.
+struct Record {
+  // 'A', 'M', 'X', 'I', 'F' or 'K' and 'B' or 'S', like in the text
+  char action;
+  char side;
+  uint16_t symbol;
+  uint32_t oid;
+  // zero for a remove
+  uint32_t volume;
+  // zero for a market order
+  uint32_t price;
+};
+static_assert(sizeof(Record) == 16, "records are 16 bytes on disk");
+static_assert(std::is_trivially_copyable<Record>::value,
+              "records get read straight out of the mapping");
+
+// what a binary feed file starts with, so it can't be mistaken for text. It's
+// the size of a record, so the records behind it stay aligned.
+struct FeedHeader {
+  static constexpr uint32_t currentVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+static_assert(sizeof(FeedHeader) == sizeof(Record),
+              "the header keeps the records aligned");
+
+inline const char *feedMagic() { return "OBFEED\0\0"; }
+
+inline Record toRecord(const Message &message) {
+  Record record;
+  record.action = static_cast<char>(message.action);
+  record.side = static_cast<char>(message.dir);
+  record.symbol = message.symbol;
+  record.oid = message.oid;
+  record.volume = message.volume;
+  record.price = message.price;
+  return record;
+}
+
+// the action and side are checked when the message gets processed, same as
+// for a parsed line
+inline Message toMessage(const Record &record) {
+  Message message;
+  message.action = static_cast<Action>(record.action);
+  message.dir = static_cast<Direction>(record.side);
+  message.oid = record.oid;
+  message.volume = record.volume;
+  message.price = record.price;
+  message.symbol = record.symbol;
+  return message;
+}
+
+// the records in a binary feed that's already in memory, e.g. a MappedFile
+struct BinaryFeed {
+  // whether the data starts out like a binary feed - otherwise it's text
+  static bool matches(const char *data, std::size_t size) {
+    return size >= sizeof(FeedHeader) &&
+           0 == memcmp(data, feedMagic(), sizeof(FeedHeader::magic));
+  }
+
+  // throws a ParseError if it isn't a feed we can read. The data has to be
+  // aligned for a Record, which a mapping is.
+  BinaryFeed(const char *data, std::size_t size) {
+    if (!matches(data, size)) {
+      throw ParseError("not a binary feed");
+    }
+    FeedHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (FeedHeader::currentVersion != header.version) {
+      throw ParseError("unsupported binary feed version");
+    }
+    if (0u != size % sizeof(Record)) {
+      throw ParseError("truncated binary feed");
+    }
+    m_begin = reinterpret_cast<const Record *>(data + sizeof(FeedHeader));
+    m_end = reinterpret_cast<const Record *>(data + size);
+  }
+
+  const Record *begin() const { return m_begin; }
+  const Record *end() const { return m_end; }
+  std::size_t size() const { return m_end - m_begin; }
+
+private:
+  const Record *m_begin;
+  const Record *m_end;
+};
+
+inline void writeFeedHeader(std::ostream &os) {
+  FeedHeader header;
+  memcpy(header.magic, feedMagic(), sizeof(header.magic));
+  header.version = FeedHeader::currentVersion;
+  header.reserved = 0;
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+inline void writeRecord(std::ostream &os, const Record &record) {
+  os.write(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // BINARYFEED_H
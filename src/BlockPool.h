@@ -0,0 +1,153 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "Common.h"
+
+namespace mvs {
+namespace orderbook {
+
+// hands out fixed size blocks of memory from slabs. Released blocks go onto a
+// free list and get handed out again, so once the pool has grown to the most
+// blocks ever in use at the same time, it doesn't allocate any more - and if
+// it's given that number up front, it never allocates after construction.
+// Blocks never move, so pointers to them stay valid until they're released.
+//
+// The block size can be left open, in which case it's set by the first
+// allocation: node based containers only know the size of their nodes once
+// they ask for one.
+struct BlockPool {
+  // what blocks are aligned to. That's enough for anything made of integers
+  // and pointers, and doesn't round small blocks up as far as max_align_t.
+  static constexpr std::size_t alignment = alignof(void *);
+
+  explicit BlockPool(std::size_t capacity, std::size_t blockSize = 0)
+      : m_reserve(std::max<std::size_t>(capacity, 64)) {
+    if (0u != blockSize) {
+      setBlockSize(blockSize);
+      grow(m_reserve);
+    }
+  }
+  BlockPool(BlockPool &) = delete;
+  BlockPool &operator=(BlockPool &) = delete;
+
+  void *allocate(std::size_t size) {
+    if (unlikely(0u == m_blockSize)) {
+      setBlockSize(size);
+    }
+    assert(size <= m_blockSize);
+    Block *block(m_free);
+    if (likely(nullptr != block)) {
+      m_free = block->next;
+    } else {
+      if (unlikely(m_unused == m_end)) {
+        // double up, like a vector would
+        grow(0u == m_capacity ? m_reserve : m_capacity);
+      }
+      block = reinterpret_cast<Block *>(m_unused);
+      m_unused += m_blockSize;
+    }
+    ++m_size;
+    return block;
+  }
+
+  void deallocate(void *ptr) noexcept {
+    assert(m_size > 0);
+    Block *block(static_cast<Block *>(ptr));
+    block->next = m_free;
+    m_free = block;
+    --m_size;
+  }
+
+  // number of blocks handed out, and the number there's room for
+  std::size_t size() const { return m_size; }
+  std::size_t capacity() const { return m_capacity; }
+  std::size_t blockSize() const { return m_blockSize; }
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  void setBlockSize(std::size_t size) {
+    // big enough to hold the free list link, and rounded up so every block
+    // stays aligned like the first one
+    m_blockSize =
+        (std::max(size, sizeof(Block)) + alignment - 1) / alignment * alignment;
+  }
+
+  // only called once the previous slab is used up. The new slab's blocks are
+  // handed out in order, rather than threaded onto the free list up front, so
+  // growing doesn't have to touch all of it.
+  void grow(std::size_t count) {
+    m_slabs.emplace_back(new char[count * m_blockSize]);
+    m_unused = m_slabs.back().get();
+    m_end = m_unused + count * m_blockSize;
+    m_capacity += count;
+  }
+
+  std::vector<std::unique_ptr<char[]>> m_slabs;
+  // number of blocks to start out with
+  const std::size_t m_reserve;
+  std::size_t m_blockSize = 0;
+  // released blocks
+  Block *m_free = nullptr;
+  // part of the newest slab that has never been handed out
+  char *m_unused = nullptr;
+  char *m_end = nullptr;
+  std::size_t m_size = 0;
+  std::size_t m_capacity = 0;
+};
+
+// lets node based standard containers ( std::map and friends ) take their
+// nodes from a BlockPool. Anything other than a single node at a time goes to
+// the heap as usual.
+template <typename T> struct PoolAllocator {
+  using value_type = T;
+
+  explicit PoolAllocator(BlockPool &pool) noexcept : m_pool(&pool) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U> &other) noexcept
+      : m_pool(other.m_pool) {}
+
+  T *allocate(std::size_t n) {
+    static_assert(alignof(T) <= BlockPool::alignment,
+                  "the pool doesn't align blocks for this");
+    if (likely(1u == n)) {
+      return static_cast<T *>(m_pool->allocate(sizeof(T)));
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T *ptr, std::size_t n) noexcept {
+    if (likely(1u == n)) {
+      m_pool->deallocate(ptr);
+    } else {
+      std::allocator<T>().deallocate(ptr, n);
+    }
+  }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &other) const {
+    return m_pool == other.m_pool;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &other) const {
+    return m_pool != other.m_pool;
+  }
+
+private:
+  template <typename U> friend struct PoolAllocator;
+
+  BlockPool *m_pool;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // BLOCKPOOL_H
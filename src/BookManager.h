@@ -0,0 +1,75 @@
+#ifndef BOOKMANAGER_H
+#define BOOKMANAGER_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+#include "OrderBook.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a book per symbol. Symbols are small numbers handed out densely from 0, so
+// finding the book for one is indexing into an array - there's no hashing of
+// names on the way to a book, that's up to whoever hands out the ids.
+//
+// Books are made the first time their symbol comes along, or up front. Each
+// book gets the same room for orders and levels, see BasicOrderBook.
+template <typename BookT = OrderBook> struct BookManager {
+  explicit BookManager(std::size_t symbols = 0, std::size_t orders = 1024,
+                       std::size_t levels = 256)
+      : m_orders(orders), m_levels(levels) {
+    for (std::size_t symbol = 0; symbol < symbols; ++symbol) {
+      create(static_cast<uint16_t>(symbol));
+    }
+  }
+  BookManager(BookManager &) = delete;
+  BookManager &operator=(BookManager &) = delete;
+
+  BookT &operator[](uint16_t symbol) {
+    if (likely(symbol < m_books.size() && m_books[symbol])) {
+      return *m_books[symbol];
+    }
+    return create(symbol);
+  }
+
+  // nullptr if nothing has come along for the symbol yet
+  const BookT *find(uint16_t symbol) const {
+    return symbol < m_books.size() ? m_books[symbol].get() : nullptr;
+  }
+
+  // the number of symbols there's room for, not all of them need a book
+  std::size_t size() const { return m_books.size(); }
+
+  // f(symbol, book) for every book there is, in symbol order
+  template <typename F> void forEach(F &&f) const {
+    for (std::size_t symbol = 0; symbol < m_books.size(); ++symbol) {
+      if (m_books[symbol]) {
+        f(static_cast<uint16_t>(symbol), *m_books[symbol]);
+      }
+    }
+  }
+
+private:
+  BookT &create(uint16_t symbol) {
+    if (symbol >= m_books.size()) {
+      m_books.resize(symbol + 1u);
+    }
+    m_books[symbol].reset(new BookT(m_orders, m_levels));
+    return *m_books[symbol];
+  }
+
+  const std::size_t m_orders;
+  const std::size_t m_levels;
+  // books don't move, so they're held by pointer - this way the array is just
+  // pointers, and stays small enough to sit in cache
+  std::vector<std::unique_ptr<BookT>> m_books;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // BOOKMANAGER_H
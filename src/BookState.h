@@ -0,0 +1,191 @@
+#ifndef BOOKSTATE_H
+#define BOOKSTATE_H
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <system_error>
+
+#include "BinaryFeed.h"
+#include "BookManager.h"
+#include "Enums.h"
+#include "Exceptions.h"
+#include "OrderBook.h"
+#include "Processor.h"
+
+namespace mvs {
+namespace orderbook {
+
+// everything resting in a book, or in all the books of a BookManager, saved
+// so it can be loaded back in one pass instead of replaying the input up to
+// that point. The orders are Records, same as in a binary feed: an add for
+// every resting order, best level first and oldest first within a level -
+// adding them back in that order gives the same queues.
+struct StateHeader {
+  static constexpr uint32_t currentVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // the number of input messages the books had been through, i.e. where to
+  // pick up the input again
+  uint64_t offset;
+  // the number of records behind the header
+  uint64_t orders;
+};
+static_assert(0u == sizeof(StateHeader) % sizeof(Record),
+              "the header keeps the records aligned");
+
+inline const char *stateMagic() { return "OBSTATE\0"; }
+
+namespace details {
+
+template <typename SideT>
+void writeSide(std::ostream &os, const SideT &side, uint16_t symbol,
+               Direction dir) {
+  side.forEach([&os, symbol, dir](uint32_t price, const Level &level) {
+    for (const Order &order : level) {
+      writeRecord(os, Record{static_cast<char>(Action::Add),
+                             static_cast<char>(dir), symbol, order.getOid(),
+                             order.getVolume(), price});
+    }
+  });
+}
+
+template <typename BookT>
+void writeBook(std::ostream &os, const BookT &book, uint16_t symbol) {
+  writeSide(os, book.getBuySide(), symbol, Direction::Buy);
+  writeSide(os, book.getSellSide(), symbol, Direction::Sell);
+}
+
+// a book on its own is symbol 0, see route
+template <typename BookT> uint64_t orderCount(const BookT &book) {
+  return book.getIndex().size();
+}
+
+template <typename BookT>
+uint64_t orderCount(const BookManager<BookT> &books) {
+  uint64_t orders(0);
+  books.forEach([&orders](uint16_t, const BookT &book) {
+    orders += book.getIndex().size();
+  });
+  return orders;
+}
+
+template <typename BookT>
+void writeBooks(std::ostream &os, const BookT &book) {
+  writeBook(os, book, 0);
+}
+
+template <typename BookT>
+void writeBooks(std::ostream &os, const BookManager<BookT> &books) {
+  books.forEach([&os](uint16_t symbol, const BookT &book) {
+    writeBook(os, book, symbol);
+  });
+}
+
+} // namespace details
+
+// BookT is a single book or a BookManager, like for the Processor
+template <typename BookT>
+void writeState(std::ostream &os, const BookT &books, uint64_t offset) {
+  StateHeader header;
+  memcpy(header.magic, stateMagic(), sizeof(header.magic));
+  header.version = StateHeader::currentVersion;
+  header.reserved = 0;
+  header.offset = offset;
+  header.orders = details::orderCount(books);
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  details::writeBooks(os, books);
+}
+
+// written next to the file and renamed over it once it's all there, so
+// there's always a whole state to go back to, even if we die halfway through.
+// Throws a std::system_error if it can't be written.
+template <typename BookT>
+void saveState(const std::string &path, const BookT &books, uint64_t offset) {
+  const std::string temp(path + ".tmp");
+  {
+    std::ofstream os(temp, std::ios::binary | std::ios::trunc);
+    // why it couldn't be opened is still in errno, a stream that fails later
+    // on doesn't say
+    if (!os.is_open()) {
+      throw std::system_error(errno, std::generic_category(), temp);
+    }
+    writeState(os, books, offset);
+    os.close();
+    if (!os) {
+      throw std::system_error(EIO, std::generic_category(), temp);
+    }
+  }
+  if (0 != std::rename(temp.c_str(), path.c_str())) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+}
+
+// a saved state that's already in memory, e.g. a MappedFile
+struct BookState {
+  static bool matches(const char *data, std::size_t size) {
+    return size >= sizeof(StateHeader) &&
+           0 == memcmp(data, stateMagic(), sizeof(StateHeader::magic));
+  }
+
+  // throws a ParseError if it isn't a state we can read. The data has to be
+  // aligned for a Record, which a mapping is.
+  BookState(const char *data, std::size_t size) {
+    if (!matches(data, size)) {
+      throw ParseError("not a saved book state");
+    }
+    StateHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (StateHeader::currentVersion != header.version) {
+      throw ParseError("unsupported book state version");
+    }
+    if (header.orders != (size - sizeof(header)) / sizeof(Record) ||
+        0u != size % sizeof(Record)) {
+      throw ParseError("truncated book state");
+    }
+    m_offset = header.offset;
+    m_begin = reinterpret_cast<const Record *>(data + sizeof(StateHeader));
+    m_end = reinterpret_cast<const Record *>(data + size);
+  }
+
+  uint64_t offset() const { return m_offset; }
+  const Record *begin() const { return m_begin; }
+  const Record *end() const { return m_end; }
+  std::size_t size() const { return m_end - m_begin; }
+
+private:
+  uint64_t m_offset;
+  const Record *m_begin;
+  const Record *m_end;
+};
+
+// puts the orders back into books that are empty to start with, without
+// matching or going through the Processor. Returns where to pick up the
+// input.
+template <typename BookT>
+uint64_t restoreState(BookT &books, const BookState &state) {
+  for (const Record &record : state) {
+    if (unlikely(static_cast<char>(Action::Add) != record.action)) {
+      throw ParseError("action mismatch");
+    }
+    auto *book(details::route(books, record.symbol));
+    if (unlikely(nullptr == book)) {
+      throw UnknownSymbolError(record.symbol);
+    }
+    book->restore(static_cast<Direction>(record.side), record.oid,
+                  record.volume, record.price);
+  }
+  return state.offset();
+}
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // BOOKSTATE_H
@@ -6,10 +6,34 @@
 namespace mvs {
 namespace orderbook {
 
-enum class Action : char { Add = 'A', Modify = 'M', Remove = 'X' };
+// Add, Modify and Remove are for limit orders that rest. The others only
+// ever take what's resting on the other side, and whatever they don't get is
+// gone - none of them rests, so their oids aren't kept:
+// - Ioc, immediate or cancel: as much as there is at the price or better
+// - Fok, fill or kill: all of it at the price or better, or nothing at all
+// - Market: as much as there is, at any price
+enum class Action : char {
+  Add = 'A',
+  Modify = 'M',
+  Remove = 'X',
+  Ioc = 'I',
+  Fok = 'F',
+  Market = 'K',
+};
 
 enum class Direction : char { Buy = 'B', Sell = 'S' };
 
+// what came of a message. Anything but Ok and it was turned down, leaving
+// the book as it was. See onError for the words that go with it.
+enum class Result : char {
+  Ok,
+  DuplicateOrderId,
+  UnknownOrderId,
+  UnknownSymbol,
+  // an action or side that isn't one, which only a binary record can have
+  BadMessage,
+};
+
 std::ostream &operator<<(std::ostream &os, Action action) {
   switch (action) {
   case Action::Add:
@@ -21,6 +45,15 @@ std::ostream &operator<<(std::ostream &os, Action action) {
   case Action::Remove:
     os << "Remove";
     break;
+  case Action::Ioc:
+    os << "Ioc";
+    break;
+  case Action::Fok:
+    os << "Fok";
+    break;
+  case Action::Market:
+    os << "Market";
+    break;
   default:
     os << "Unknown";
     break;
@@ -1,31 +1,87 @@
 #ifndef EXCEPTIONS_H
 #define EXCEPTIONS_H
 
-#include <boost/format.hpp>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <string>
 
-#include <stdexcept>
+#include "Enums.h"
 
 namespace mvs {
 namespace orderbook {
 
-struct DuplicateOrderIdError : std::runtime_error {
-  DuplicateOrderIdError(uint32_t oid)
-      : std::runtime_error((boost::format("duplicate oid %1%") % oid).str()){};
+// the message is formatted into a buffer inside the exception itself, so
+// throwing one doesn't allocate. Anything that doesn't fit is cut off.
+struct OrderBookError : std::exception {
+  const char *what() const noexcept override { return m_what; }
+
+protected:
+  OrderBookError() { m_what[0] = '\0'; }
+
+  template <typename... Args> void format(const char *fmt, Args... args) {
+    snprintf(m_what, sizeof(m_what), fmt, args...);
+  }
+
+private:
+  char m_what[128];
+};
+
+struct DuplicateOrderIdError : OrderBookError {
+  DuplicateOrderIdError(uint32_t oid) { format("duplicate oid %" PRIu32, oid); }
 };
 
-struct UnknownOrderIdError : std::runtime_error {
-  UnknownOrderIdError(uint32_t oid)
-      : std::runtime_error((boost::format("unknown oid %1%") % oid).str()){};
+struct UnknownOrderIdError : OrderBookError {
+  UnknownOrderIdError(uint32_t oid) { format("unknown oid %" PRIu32, oid); }
 };
 
-struct ParseError : std::runtime_error {
-  ParseError() : std::runtime_error("") {}
+struct UnknownSymbolError : OrderBookError {
+  UnknownSymbolError(uint16_t symbol) {
+    format("unknown symbol %" PRIu16, symbol);
+  }
+};
+
+struct ParseError : OrderBookError {
+  ParseError() = default;
 
-  ParseError(const std::string &line)
-      : std::runtime_error((boost::format("parse error: '%1%'") % line).str()) {
+  ParseError(const char *line) { format("parse error: '%s'", line); }
+  ParseError(const std::string &line) : ParseError(line.c_str()) {}
+  // for lines that aren't null terminated
+  ParseError(const char *line, std::size_t length) {
+    format("parse error: '%.*s'", static_cast<int>(length), line);
   }
 };
 
+// f(the exception that goes with a message turned down with result), to
+// throw or just to log its what(). It's only formatted here, so turning a
+// message down costs nothing until someone wants to read about it. Nothing
+// happens for Ok.
+template <typename F>
+void onError(Result result, uint16_t symbol, uint32_t oid, F &&f) {
+  switch (result) {
+  case Result::Ok:
+    break;
+  case Result::DuplicateOrderId:
+    f(DuplicateOrderIdError(oid));
+    break;
+  case Result::UnknownOrderId:
+    f(UnknownOrderIdError(oid));
+    break;
+  case Result::UnknownSymbol:
+    f(UnknownSymbolError(symbol));
+    break;
+  default:
+    f(ParseError("bad action or side"));
+    break;
+  }
+}
+
+// for callers that would rather have the exception
+inline void throwOnError(Result result, uint16_t symbol, uint32_t oid) {
+  onError(result, symbol, oid, [](const auto &e) { throw e; });
+}
+
 } // namespace orderbook
 } // namespace mvs
 
@@ -0,0 +1,295 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Actions.h"
+#include "BinaryFeed.h"
+#include "Common.h"
+#include "Exceptions.h"
+#include "Parser.h"
+#include "SpscRing.h"
+#include "TradeSink.h"
+
+namespace mvs {
+namespace orderbook {
+
+// one entry in a journal: a message that came in, or a trade that came out of
+// one. A message's trades come right after it.
+struct JournalEntry {
+  // the input message this is, or the trade came out of, counting from 1 -
+  // so everything up to the offset of a saved state is in that state
+  uint64_t sequence;
+  // a message as it came in. For a trade, the action is 'T', the side is
+  // left empty, and the oid is the buy order's.
+  Record record;
+  // trades only
+  uint32_t sellOid;
+  uint32_t reserved;
+};
+static_assert(sizeof(JournalEntry) == 32, "entries are 32 bytes on disk");
+static_assert(std::is_trivially_copyable<JournalEntry>::value,
+              "entries get read straight out of the mapping");
+
+constexpr char tradeEntry = 'T';
+
+// same as a binary feed's, so the entries behind it stay aligned
+struct JournalHeader {
+  static constexpr uint32_t currentVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+static_assert(sizeof(JournalHeader) == sizeof(FeedHeader),
+              "the header keeps the entries aligned");
+
+inline const char *journalMagic() { return "OBJRNL\0\0"; }
+
+inline JournalEntry toEntry(uint64_t sequence, const Message &message) {
+  JournalEntry entry;
+  entry.sequence = sequence;
+  entry.record = toRecord(message);
+  entry.sellOid = 0;
+  entry.reserved = 0;
+  return entry;
+}
+
+inline JournalEntry toEntry(uint64_t sequence, uint16_t symbol,
+                            const Trade &trade) {
+  JournalEntry entry;
+  entry.sequence = sequence;
+  entry.record = Record{tradeEntry, 0, symbol, trade.getBuyOid(),
+                        trade.getVolume(), trade.getPrice()};
+  entry.sellOid = trade.getSellOid();
+  entry.reserved = 0;
+  return entry;
+}
+
+inline Trade toTrade(const JournalEntry &entry) {
+  return Trade(entry.record.oid, entry.sellOid, entry.record.volume,
+               entry.record.price);
+}
+
+// how far a group has to get before the next one goes out
+enum class Durability : char {
+  // handed to the kernel - it survives us crashing, not the machine
+  Write,
+  // and synced to disk
+  Sync,
+};
+
+// an append only journal of what went in and came out, written by a thread
+// of its own. Whoever's matching only copies entries into a ring; the journal
+// thread takes whatever has piled up since its last write as one group, and
+// writes ( and syncs ) it in one go. The busier it gets, the bigger the
+// groups, so one sync covers more entries.
+//
+// If the ring fills up, because the disk can't keep up, appending waits for
+// room, for up to the stall timeout. A disk that's stuck for longer than
+// that fails the journal with ETIMEDOUT, the same as a write that fails:
+// the entry is dropped, and so is everything after it, so the journal is
+// never left with a gap in it.
+struct Journal {
+  // the file gets a header if it's empty, otherwise the entries go on the
+  // end of it - after cutting off any half written entry a crash left there
+  explicit Journal(int fd, Durability durability = Durability::Write,
+                   std::size_t ringCapacity = 1 << 16,
+                   std::size_t maxGroup = 1 << 12,
+                   std::chrono::milliseconds stallTimeout =
+                       std::chrono::seconds(5))
+      : m_fd(fd), m_durability(durability), m_stallTimeout(stallTimeout),
+        m_ring(ringCapacity), m_group(maxGroup) {
+    off_t size(::lseek(m_fd, 0, SEEK_END));
+    if (size < 0) {
+      throw std::system_error(errno, std::generic_category(), "lseek");
+    }
+    const off_t whole(size < off_t(sizeof(JournalHeader))
+                          ? 0
+                          : size - (size - sizeof(JournalHeader)) %
+                                       sizeof(JournalEntry));
+    if (whole != size) {
+      if (0 != ::ftruncate(m_fd, whole)) {
+        throw std::system_error(errno, std::generic_category(), "ftruncate");
+      }
+      size = whole;
+    }
+    if (0 == size) {
+      JournalHeader header;
+      memcpy(header.magic, journalMagic(), sizeof(header.magic));
+      header.version = JournalHeader::currentVersion;
+      header.reserved = 0;
+      FdWriter::writeAll(m_fd, reinterpret_cast<const char *>(&header),
+                         sizeof(header));
+    }
+    m_thread = std::thread([this] { run(); });
+  }
+  Journal(Journal &) = delete;
+  Journal &operator=(Journal &) = delete;
+
+  ~Journal() { stop(); }
+
+  // writes out everything that's been appended, then waits for the journal
+  // thread to finish
+  void stop() {
+    m_running.store(false, std::memory_order_release);
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  // only ever from one thread
+  void append(const JournalEntry &entry) {
+    if (unlikely(!m_ring.push(entry))) {
+      stall(entry);
+    }
+  }
+
+  void message(uint64_t sequence, const Message &message) {
+    append(toEntry(sequence, message));
+  }
+
+  void trade(uint64_t sequence, uint16_t symbol, const Trade &trade) {
+    append(toEntry(sequence, symbol, trade));
+  }
+
+  // the sequence of the last entry that's as durable as it's going to get,
+  // from any thread
+  uint64_t committed() const {
+    return m_committed.load(std::memory_order_acquire);
+  }
+
+  // the errno of the write or sync that failed, or ETIMEDOUT if appending
+  // stalled for too long - nothing gets written after that
+  int error() const { return m_error.load(std::memory_order_acquire); }
+
+  // only once it's stopped
+  uint64_t groups() const { return m_groups; }
+  // the number of times append had to wait for room, appending thread only
+  uint64_t stalls() const { return m_stalls; }
+
+private:
+  // waiting for the journal thread to make room, as long as it's not failed
+  void stall(const JournalEntry &entry) {
+    ++m_stalls;
+    const auto deadline(std::chrono::steady_clock::now() + m_stallTimeout);
+    while (0 == m_error.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+      if (m_ring.push(entry)) {
+        return;
+      }
+      if (std::chrono::steady_clock::now() > deadline) {
+        fail(ETIMEDOUT);
+      }
+    }
+  }
+
+  // only the first error is kept
+  void fail(int error) {
+    int none(0);
+    m_error.compare_exchange_strong(none, error, std::memory_order_release,
+                                    std::memory_order_relaxed);
+  }
+
+  void run() {
+    while (true) {
+      // anything appended before we were told to stop is in the ring by the
+      // time we see it
+      const bool running(m_running.load(std::memory_order_acquire));
+      std::size_t count(0);
+      while (count < m_group.size() && m_ring.pop(m_group[count])) {
+        ++count;
+      }
+      if (0u != count) {
+        write(count);
+      } else if (running) {
+        std::this_thread::yield();
+      } else {
+        break;
+      }
+    }
+  }
+
+  void write(std::size_t count) {
+    if (0 != m_error.load(std::memory_order_relaxed)) {
+      return;
+    }
+    try {
+      FdWriter::writeAll(m_fd, reinterpret_cast<const char *>(m_group.data()),
+                         count * sizeof(JournalEntry));
+      if (Durability::Sync == m_durability && 0 != ::fdatasync(m_fd)) {
+        throw std::system_error(errno, std::generic_category(), "fdatasync");
+      }
+    } catch (const std::system_error &e) {
+      fail(e.code().value());
+      return;
+    }
+    ++m_groups;
+    m_committed.store(m_group[count - 1].sequence, std::memory_order_release);
+  }
+
+  const int m_fd;
+  const Durability m_durability;
+  const std::chrono::milliseconds m_stallTimeout;
+  SpscRing<JournalEntry> m_ring;
+  uint64_t m_stalls = 0;
+
+  // the journal thread's
+  std::vector<JournalEntry> m_group;
+  uint64_t m_groups = 0;
+
+  std::atomic<uint64_t> m_committed{0};
+  std::atomic<int> m_error{0};
+  std::atomic<bool> m_running{true};
+  std::thread m_thread;
+};
+
+// the entries in a journal that's already in memory, e.g. a MappedFile. A
+// crash can leave half an entry at the end, which is left out.
+struct JournalReader {
+  // throws a ParseError if it isn't a journal we can read. The data has to
+  // be aligned for an entry, which a mapping is.
+  JournalReader(const char *data, std::size_t size) {
+    if (size < sizeof(JournalHeader) ||
+        0 != memcmp(data, journalMagic(), sizeof(JournalHeader::magic))) {
+      throw ParseError("not a journal");
+    }
+    JournalHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (JournalHeader::currentVersion != header.version) {
+      throw ParseError("unsupported journal version");
+    }
+    const std::size_t entries((size - sizeof(header)) / sizeof(JournalEntry));
+    m_begin =
+        reinterpret_cast<const JournalEntry *>(data + sizeof(JournalHeader));
+    m_end = m_begin + entries;
+    m_torn = size - sizeof(header) - entries * sizeof(JournalEntry);
+  }
+
+  const JournalEntry *begin() const { return m_begin; }
+  const JournalEntry *end() const { return m_end; }
+  std::size_t size() const { return m_end - m_begin; }
+  // the bytes of the entry that was being written when we crashed, if any
+  std::size_t torn() const { return m_torn; }
+
+private:
+  const JournalEntry *m_begin;
+  const JournalEntry *m_end;
+  std::size_t m_torn;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // JOURNAL_H
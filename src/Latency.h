@@ -0,0 +1,256 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Common.h"
+#include "Enums.h"
+
+namespace mvs {
+namespace orderbook {
+
+// counts of values, HDR style: exact below 2^subBits, and above that 2^subBits
+// buckets for every power of two, so anything recorded is within about 3% of
+// what it's reported as. Recording is a couple of shifts and an increment,
+// and the buckets don't take more than 16KB whatever the values are.
+struct LatencyHistogram {
+  static constexpr unsigned subBits = 5;
+  static constexpr uint64_t subCount = 1u << subBits;
+
+  LatencyHistogram() : m_counts(bucket(~uint64_t(0)) + 1) {}
+
+  void record(uint64_t value) {
+    ++m_counts[bucket(value)];
+    ++m_count;
+    m_max = std::max(m_max, value);
+  }
+
+  void add(const LatencyHistogram &other) {
+    for (std::size_t i = 0; i < m_counts.size(); ++i) {
+      m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_max = std::max(m_max, other.m_max);
+  }
+
+  void clear() {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+    m_max = 0;
+  }
+
+  uint64_t count() const { return m_count; }
+  uint64_t max() const { return m_max; }
+
+  // the value at or below which a fraction p of the values are, as the top
+  // of its bucket - never more than the biggest one recorded
+  uint64_t percentile(double p) const {
+    if (0u == m_count) {
+      return 0;
+    }
+    const uint64_t rank(std::max<uint64_t>(1, std::ceil(p * m_count)));
+    uint64_t seen(0);
+    for (std::size_t i = 0; i < m_counts.size(); ++i) {
+      seen += m_counts[i];
+      if (seen >= rank) {
+        return std::min(highest(i), m_max);
+      }
+    }
+    return m_max;
+  }
+
+private:
+  static std::size_t bucket(uint64_t value) {
+    if (value < subCount) {
+      return value;
+    }
+    const unsigned shift(63 - __builtin_clzll(value) - subBits);
+    return (shift + 1) * subCount + ((value >> shift) - subCount);
+  }
+
+  // the biggest value that goes in bucket i
+  static uint64_t highest(std::size_t i) {
+    if (i < subCount) {
+      return i;
+    }
+    const unsigned shift(i / subCount - 1);
+    const uint64_t sub(i % subCount + subCount);
+    return ((sub + 1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> m_counts;
+  uint64_t m_count = 0;
+  uint64_t m_max = 0;
+};
+
+// the kinds of message that get a histogram of their own. An add that trades
+// is kept apart from one that just rests, and one that trades a lot - a deep
+// sweep - apart from both. Orders that never rest ( IOC, FOK and market ) go
+// together.
+enum class MessageShape : std::size_t {
+  Add,
+  AddTrades,
+  AddSweeps,
+  Modify,
+  Remove,
+  Immediate,
+  Rejected,
+  Count
+};
+
+// adds with more trades than this are sweeps
+constexpr uint32_t sweepTrades = 8;
+
+inline const char *shapeName(MessageShape shape) {
+  static const char *names[] = {"add",    "add+trades", "add+sweep",
+                                "modify", "remove",     "immediate",
+                                "rejected"};
+  return names[static_cast<std::size_t>(shape)];
+}
+
+inline MessageShape shapeOf(Action action, uint32_t trades) {
+  switch (action) {
+  case Action::Add:
+    return 0u == trades              ? MessageShape::Add
+           : trades <= sweepTrades ? MessageShape::AddTrades
+                                   : MessageShape::AddSweeps;
+  case Action::Modify:
+    return MessageShape::Modify;
+  case Action::Remove:
+    return MessageShape::Remove;
+  default:
+    return MessageShape::Immediate;
+  }
+}
+
+// the time every message takes to process, by its shape, reported every so
+// many messages ( for those messages ) and once more at the end ( for all of
+// them ). Time is counted in TSC ticks where there's a TSC, which is a lot
+// cheaper to read than the clock, and turned into ns for the report.
+struct MessageLatencies {
+  static constexpr bool enabled = true;
+
+  // every is in messages, 0 for only at the end
+  explicit MessageLatencies(std::ostream &os, uint64_t every = 0)
+      : m_os(os), m_every(every), m_startTicks(ticks()),
+        m_startTime(std::chrono::steady_clock::now()) {}
+  MessageLatencies(MessageLatencies &) = delete;
+  MessageLatencies &operator=(MessageLatencies &) = delete;
+
+  static uint64_t start() { return ticks(); }
+
+  void stop(uint64_t started, MessageShape shape) {
+    m_recent[static_cast<std::size_t>(shape)].record(ticks() - started);
+    if (unlikely(0u != m_every && 0u == ++m_messages % m_every)) {
+      report("last " + std::to_string(m_every), m_recent);
+      for (std::size_t i = 0; i < shapes; ++i) {
+        m_total[i].add(m_recent[i]);
+        m_recent[i].clear();
+      }
+    }
+  }
+
+  // everything so far
+  void report() {
+    for (std::size_t i = 0; i < shapes; ++i) {
+      m_total[i].add(m_recent[i]);
+      m_recent[i].clear();
+    }
+    report("all", m_total);
+  }
+
+  const LatencyHistogram &total(MessageShape shape) const {
+    return m_total[static_cast<std::size_t>(shape)];
+  }
+
+private:
+  static constexpr std::size_t shapes =
+      static_cast<std::size_t>(MessageShape::Count);
+
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // how many ns a tick is, going by how many there have been since we started
+  double nsPerTick() const {
+    const double ns(std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - m_startTime)
+                        .count());
+    const uint64_t elapsed(ticks() - m_startTicks);
+    return 0u == elapsed ? 1.0 : ns / elapsed;
+  }
+
+  void report(const std::string &which,
+              const LatencyHistogram (&histograms)[shapes]) {
+    const double scale(nsPerTick());
+    char line[128];
+    snprintf(line, sizeof(line), "%-18s %10s %8s %8s %8s %10s\n",
+             ("ns, " + which).c_str(), "count", "p50", "p99", "p99.9", "max");
+    m_os << line;
+    for (std::size_t i = 0; i < shapes; ++i) {
+      const LatencyHistogram &histogram(histograms[i]);
+      if (0u == histogram.count()) {
+        continue;
+      }
+      auto ns = [scale](uint64_t ticks) {
+        return static_cast<unsigned long long>(ticks * scale + 0.5);
+      };
+      snprintf(line, sizeof(line), "%-18s %10llu %8llu %8llu %8llu %10llu\n",
+               shapeName(static_cast<MessageShape>(i)),
+               static_cast<unsigned long long>(histogram.count()),
+               ns(histogram.percentile(0.5)), ns(histogram.percentile(0.99)),
+               ns(histogram.percentile(0.999)), ns(histogram.max()));
+      m_os << line;
+    }
+    m_os.flush();
+  }
+
+  std::ostream &m_os;
+  const uint64_t m_every;
+  uint64_t m_messages = 0;
+  const uint64_t m_startTicks;
+  const std::chrono::steady_clock::time_point m_startTime;
+  LatencyHistogram m_recent[shapes];
+  LatencyHistogram m_total[shapes];
+};
+
+// the same, only it's all gone once compiled
+struct NoLatencies {
+  static constexpr bool enabled = false;
+
+  explicit NoLatencies(std::ostream &, uint64_t = 0) {}
+
+  static uint64_t start() { return 0; }
+  void stop(uint64_t, MessageShape) {}
+  void report() {}
+};
+
+// build with -DORDERBOOK_LATENCY to have main time every message
+#ifdef ORDERBOOK_LATENCY
+using Latencies = MessageLatencies;
+#else
+using Latencies = NoLatencies;
+#endif
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // LATENCY_H
@@ -0,0 +1,172 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <assert.h>
+
+#include <cinttypes>
+#include <cstddef>
+#include <iterator>
+
+#include "Order.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a price level, added up
+struct LevelSummary {
+  uint32_t price;
+  uint32_t orders;
+  uint64_t volume;
+};
+
+// all orders resting at one price, oldest first. The orders are linked
+// through themselves ( see Order ), so taking the oldest one off, or any one
+// we hold a pointer to, doesn't move anything else around - and the level
+// never allocates. It doesn't own the orders either; that's the OrderPool.
+//
+// The level keeps count of its orders and their total volume as they come and
+// go, so neither takes a walk through the orders. That means an order's
+// volume can only go down through the level it's in.
+struct Level {
+  template <typename OrderT> struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Order;
+    using difference_type = std::ptrdiff_t;
+    using pointer = OrderT *;
+    using reference = OrderT &;
+
+    explicit Iterator(OrderT *order) : m_order(order) {}
+
+    reference operator*() const { return *m_order; }
+    pointer operator->() const { return m_order; }
+    Iterator &operator++() {
+      m_order = m_order->m_next;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator iter(*this);
+      m_order = m_order->m_next;
+      return iter;
+    }
+    bool operator==(const Iterator &other) const {
+      return m_order == other.m_order;
+    }
+    bool operator!=(const Iterator &other) const {
+      return m_order != other.m_order;
+    }
+
+  private:
+    OrderT *m_order;
+  };
+  using iterator = Iterator<Order>;
+  using const_iterator = Iterator<const Order>;
+
+  Level() = default;
+  Level(Level &) = delete;
+  Level &operator=(Level &) = delete;
+
+  // the orders don't point back at their level, so moving one is just a
+  // matter of taking over its ends
+  Level(Level &&other) noexcept
+      : m_head(other.m_head), m_tail(other.m_tail), m_size(other.m_size),
+        m_volume(other.m_volume) {
+    other.clear();
+  }
+  Level &operator=(Level &&other) noexcept {
+    m_head = other.m_head;
+    m_tail = other.m_tail;
+    m_size = other.m_size;
+    m_volume = other.m_volume;
+    other.clear();
+    return *this;
+  }
+
+  void push_back(Order *order) noexcept {
+    order->m_prev = m_tail;
+    order->m_next = nullptr;
+    if (m_tail) {
+      m_tail->m_next = order;
+    } else {
+      m_head = order;
+    }
+    m_tail = order;
+    ++m_size;
+    m_volume += order->getVolume();
+  }
+
+  Order *pop_front() noexcept {
+    assert(!empty());
+    Order *order(m_head);
+    erase(order);
+    return order;
+  }
+
+  // the order has to be in this level
+  void erase(Order *order) noexcept {
+    assert(!empty());
+    if (order->m_prev) {
+      order->m_prev->m_next = order->m_next;
+    } else {
+      m_head = order->m_next;
+    }
+    if (order->m_next) {
+      order->m_next->m_prev = order->m_prev;
+    } else {
+      m_tail = order->m_prev;
+    }
+    order->m_prev = order->m_next = nullptr;
+    --m_size;
+    m_volume -= order->getVolume();
+  }
+
+  // takes volume off an order in this level, not all of it
+  void reduce(Order &order, uint32_t volume) noexcept {
+    order.reduceVolume(volume);
+    m_volume -= volume;
+  }
+
+  // forgets about the orders, it's up to the caller to release them
+  void clear() noexcept {
+    m_head = m_tail = nullptr;
+    m_size = 0;
+    m_volume = 0;
+  }
+
+  Order &front() {
+    assert(!empty());
+    return *m_head;
+  }
+  const Order &front() const {
+    assert(!empty());
+    return *m_head;
+  }
+  Order &back() {
+    assert(!empty());
+    return *m_tail;
+  }
+  const Order &back() const {
+    assert(!empty());
+    return *m_tail;
+  }
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return 0u == m_size; }
+  // of all the orders in the level together
+  uint64_t volume() const { return m_volume; }
+
+  iterator begin() { return iterator(m_head); }
+  iterator end() { return iterator(nullptr); }
+  const_iterator begin() const { return const_iterator(m_head); }
+  const_iterator end() const { return const_iterator(nullptr); }
+
+private:
+  Order *m_head = nullptr;
+  Order *m_tail = nullptr;
+  std::size_t m_size = 0;
+  uint64_t m_volume = 0;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // LEVEL_H
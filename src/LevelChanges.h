@@ -0,0 +1,72 @@
+#ifndef LEVELCHANGES_H
+#define LEVELCHANGES_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+#include "Common.h"
+#include "Enums.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a price level as it is after a message changed it. A level that's gone
+// has no orders and no volume left.
+struct LevelUpdate {
+  Direction dir;
+  uint32_t price;
+  uint32_t orders;
+  uint64_t volume;
+};
+
+// the levels one message changed, each one once however often it was
+// touched. The book only notes which ones - what they look like afterwards
+// comes from the levels themselves once the message is done.
+struct LevelChanges {
+  explicit LevelChanges(std::size_t reserve = 64) {
+    m_touched.reserve(reserve);
+  }
+  LevelChanges(LevelChanges &) = delete;
+  LevelChanges &operator=(LevelChanges &) = delete;
+
+  void touch(Direction dir, uint32_t price) {
+    // matching keeps coming back to the same level, so check the last one
+    // before going through the lot
+    if (likely(!m_touched.empty()) && m_touched.back().dir == dir &&
+        m_touched.back().price == price) {
+      return;
+    }
+    for (const Touched &touched : m_touched) {
+      if (touched.dir == dir && touched.price == price) {
+        return;
+      }
+    }
+    m_touched.push_back(Touched{dir, price});
+  }
+
+  void clear() { m_touched.clear(); }
+
+  std::size_t size() const { return m_touched.size(); }
+  bool empty() const { return m_touched.empty(); }
+
+  // f(dir, price) in the order they were first touched
+  template <typename F> void forEach(F &&f) const {
+    for (const Touched &touched : m_touched) {
+      f(touched.dir, touched.price);
+    }
+  }
+
+private:
+  struct Touched {
+    Direction dir;
+    uint32_t price;
+  };
+
+  std::vector<Touched> m_touched;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // LEVELCHANGES_H
@@ -0,0 +1,97 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include "Common.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a whole input file mapped into memory, read only. Lines get handed out as
+// pointer and length straight into the mapping, so nothing is copied on the
+// way to the parser - the kernel reads ahead since we tell it we're going
+// through the file front to back.
+struct MappedFile {
+  explicit MappedFile(const char *path) {
+    const int fd(::open(path, O_RDONLY));
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      const int error(errno);
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    m_size = st.st_size;
+    if (m_size > 0) {
+      void *data(::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0));
+      if (MAP_FAILED == data) {
+        const int error(errno);
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+      }
+      m_data = static_cast<const char *>(data);
+      ::madvise(data, m_size, MADV_SEQUENTIAL);
+    }
+    // the mapping stays valid without it
+    ::close(fd);
+    m_pos = m_data;
+  }
+
+  MappedFile(MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (nullptr != m_data) {
+      ::munmap(const_cast<char *>(m_data), m_size);
+    }
+  }
+
+  // the next line, without its end of line. Returns false at the end of the
+  // file. The last line doesn't need an end of line.
+  bool getline(const char *&line, std::size_t &length) {
+    const char *end(m_data + m_size);
+    if (unlikely(m_pos == end)) {
+      return false;
+    }
+    const char *eol(static_cast<const char *>(
+        memchr(m_pos, '\n', static_cast<std::size_t>(end - m_pos))));
+    line = m_pos;
+    if (likely(nullptr != eol)) {
+      length = static_cast<std::size_t>(eol - m_pos);
+      m_pos = eol + 1;
+    } else {
+      length = static_cast<std::size_t>(end - m_pos);
+      m_pos = end;
+    }
+    return true;
+  }
+
+  // start over from the beginning of the file
+  void rewind() { m_pos = m_data; }
+
+  const char *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  // start of the next line
+  const char *m_pos = nullptr;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // MAPPEDFILE_H
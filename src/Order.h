@@ -12,6 +12,10 @@
 namespace mvs {
 namespace orderbook {
 
+struct Level;
+
+// an order resting in the book. It's also a node in the queue of orders at
+// its price level, so once it's in there it stays put.
 struct Order {
   template <Direction dir>
   Order(const OrderAction<Action::Add, dir> &oaction)
@@ -20,9 +24,6 @@ struct Order {
   Order(Order &) = delete;
   Order &operator=(Order &) = delete;
 
-  Order(Order &&) = default;
-  Order &operator=(Order &&) = default;
-
   uint32_t getOid() const { return m_oid; }
   uint32_t getVolume() const { return m_volume; }
   void reduceVolume(uint32_t volume) noexcept {
@@ -33,8 +34,12 @@ struct Order {
   }
 
 private:
+  friend struct Level;
+
   uint32_t m_oid;
   uint32_t m_volume;
+  Order *m_prev = nullptr;
+  Order *m_next = nullptr;
 };
 
 } // namespace orderbook
@@ -7,210 +7,458 @@
 #include <iostream>
 #include <iterator>
 #include <limits>
-#include <map>
-#include <vector>
 
 #include "Enums.h"
 #include "Exceptions.h"
+#include "LevelChanges.h"
 #include "Order.h"
+#include "OrderIndex.h"
+#include "OrderPool.h"
+#include "PriceLadder.h"
 
 namespace mvs {
 namespace orderbook {
 
-template <Direction direction> struct MapType {};
+template <Direction direction, template <Direction> class Ladder = MapLadder>
+struct OrderSide : public Ladder<direction> {
+  using LadderT = Ladder<direction>;
+  using LevelT = typename LadderT::LevelT;
 
-// buy orders are stored in a map that has the highest price first
-template <> struct MapType<Direction::Buy> {
-  using VctT = std::vector<Order>;
-  using value_type = std::map<uint32_t, VctT, std::greater<uint32_t>>;
-};
-
-// sell orders are stored in a map that has the lowest price first
-template <> struct MapType<Direction::Sell> {
-  using VctT = std::vector<Order>;
-  using value_type = std::map<uint32_t, VctT, std::less<uint32_t>>;
-};
-
-template <Direction direction>
-struct OrderSide : public MapType<direction>::value_type {
-  using MapT = typename MapType<direction>::value_type;
-  using VctT = typename MapT::mapped_type;
-  using value_type = typename MapT::value_type;
-  using iterator = typename MapT::iterator;
-
-  OrderSide() = default;
+  OrderSide(OrderIndex &index, OrderPool &pool, LevelChanges &changes,
+            std::size_t levels)
+      : LadderT(levels), m_index(index), m_pool(pool), m_changes(changes) {}
   OrderSide(OrderSide &) = delete;
   OrderSide &operator=(OrderSide &) = delete;
 
-  inline void handle(const OrderAction<Action::Add, direction> &oaction);
-  inline void handle(const OrderAction<Action::Remove, direction> &oaction);
-  inline void handle(const OrderAction<Action::Modify, direction> &oaction);
+  // anything but Ok and the side is as it was
+  inline Result handle(const OrderAction<Action::Add, direction> &oaction);
+  inline Result handle(const OrderAction<Action::Remove, direction> &oaction);
+  inline Result handle(const OrderAction<Action::Modify, direction> &oaction);
+
+  // takes volume off the order at the front of the best level, removing the
+  // order ( and the level ) once nothing is left of it
+  inline void reduceFront(uint32_t volume) noexcept;
 
-  value_type const &front() const {
-    assert(!MapT::empty());
-    return *MapT::begin();
+  // whether an order from the other side at this price would trade
+  bool crosses(uint32_t price) const {
+    return !LadderT::empty() &&
+           (Direction::Buy == direction ? LadderT::front().first >= price
+                                        : LadderT::front().first <= price);
   }
-  value_type &front() {
-    assert(!MapT::empty());
-    return *MapT::begin();
+
+  // whether there's at least volume resting at price or better, for an order
+  // from the other side. Goes by the levels' running totals, so it's a level
+  // at a time, not an order.
+  bool canFill(uint32_t volume, uint32_t price) const {
+    uint64_t resting(0);
+    LadderT::forEachWhile([&](uint32_t levelPrice, const LevelT &orders) {
+      if (Direction::Buy == direction ? levelPrice < price
+                                      : levelPrice > price) {
+        return false;
+      }
+      resting += orders.volume();
+      return resting < volume;
+    });
+    return resting >= volume;
   }
-};
 
-struct OrderBook {
-  using BuySide = OrderSide<Direction::Buy>;
-  using SellSide = OrderSide<Direction::Sell>;
+  // fills volume coming in from the other side at up to price, against the
+  // orders resting here - best price first, oldest first at each price.
+  // fill(oid, volume, price) for each resting order it trades with, before
+  // it's taken off. Each level is looked up once, however many orders it
+  // goes through. Returns the volume that's left.
+  template <typename F>
+  inline uint32_t take(uint32_t volume, uint32_t price, F &&fill) noexcept;
+
+  // the best levels, up to count of them, straight from the levels' running
+  // totals. Returns how many there were.
+  std::size_t depth(LevelSummary *levels, std::size_t count) const {
+    std::size_t filled(0);
+    if (0u == count) {
+      return 0;
+    }
+    LadderT::forEachWhile(
+        [levels, count, &filled](uint32_t price, const LevelT &orders) {
+          LevelSummary &level(levels[filled++]);
+          level.price = price;
+          level.orders = static_cast<uint32_t>(orders.size());
+          level.volume = orders.volume();
+          return filled < count;
+        });
+    return filled;
+  }
+
+private:
+  // takes the order out of its level, and the level out of the ladder if it
+  // was the last order there
+  inline void eraseOrder(uint32_t oid, const OrderLocation &location) noexcept;
+
+  OrderIndex &m_index;
+  OrderPool &m_pool;
+  LevelChanges &m_changes;
+};
 
-  OrderBook() = default;
-  OrderBook(OrderBook &) = delete;
-  OrderBook &operator=(OrderBook &) = delete;
+// the ladder used for both sides of the book is a template parameter, so
+// different ones can be compared on the same input. See PriceLadder.h.
+template <template <Direction> class Ladder> struct BasicOrderBook {
+  using BuySide = OrderSide<Direction::Buy, Ladder>;
+  using SellSide = OrderSide<Direction::Sell, Ladder>;
+
+  // room is made up front for this many resting orders, and this many price
+  // levels on each side. The book grows past that if it has to, but as long
+  // as it doesn't, adding, matching and cancelling never allocate.
+  explicit BasicOrderBook(std::size_t orders = 1024, std::size_t levels = 256)
+      : m_index(orders), m_pool(orders),
+        m_buySide(m_index, m_pool, m_changes, levels),
+        m_sellSide(m_index, m_pool, m_changes, levels) {}
+  BasicOrderBook(BasicOrderBook &) = delete;
+  BasicOrderBook &operator=(BasicOrderBook &) = delete;
 
   double getMidPrice() const;
 
+  // a message that's turned down doesn't throw, it comes back as anything
+  // but Ok, having changed nothing
   template <Action action, typename FillsCallback>
-  void handle(const OrderAction<action, Direction::Buy> &oaction,
-              FillsCallback &cb);
+  Result handle(const OrderAction<action, Direction::Buy> &oaction,
+                FillsCallback &cb);
 
   template <Action action, typename FillsCallback>
-  void handle(const OrderAction<action, Direction::Sell> &oaction,
-              FillsCallback &cb);
+  Result handle(const OrderAction<action, Direction::Sell> &oaction,
+                FillsCallback &cb);
+
+  // for batches, see Processor: starts bringing in what a message for oid at
+  // price on dir's side is going to touch, ahead of it. Finding a resting
+  // order goes through its slot in the index, so that's two steps - the slot
+  // and the level first, and once the slot is in, the order and the level
+  // it's resting at. Neither changes anything.
+  void prefetch(Direction dir, uint32_t oid, uint32_t price) const {
+    m_index.prefetch(oid);
+    prefetchLevel(dir, price);
+  }
+  void prefetchOrder(uint32_t oid) const {
+    const OrderLocation *location(m_index.find(oid));
+    if (nullptr != location) {
+      __builtin_prefetch(location->order);
+      prefetchLevel(location->dir, location->price);
+    }
+  }
 
+  // for modifies that end up crossing - adds don't rest until they've traded
+  // what they can
   template <Direction dir, typename FillsCallback>
   void match(FillsCallback &cb) noexcept;
 
+  // puts a resting order back, behind the ones already at its price, without
+  // matching it - for loading a saved book, see BookState.h. Throws if the
+  // order can't go back.
+  void restore(Direction dir, uint32_t oid, uint32_t volume, uint32_t price);
+
+  // f(LevelUpdate) for every level the last message changed, once each and
+  // as it is now - an L2 delta feed, without going through the book
+  template <typename F> void forEachUpdate(F &&f) const;
+
+  // L2, see OrderSide::depth
+  std::size_t getBids(LevelSummary *levels, std::size_t count) const {
+    return m_buySide.depth(levels, count);
+  }
+  std::size_t getAsks(LevelSummary *levels, std::size_t count) const {
+    return m_sellSide.depth(levels, count);
+  }
+
   BuySide const &getBuySide() const { return m_buySide; }
   SellSide const &getSellSide() const { return m_sellSide; }
+  OrderIndex const &getIndex() const { return m_index; }
+
+private:
+  void prefetchLevel(Direction dir, uint32_t price) const {
+    if (Direction::Buy == dir) {
+      m_buySide.prefetch(price);
+    } else {
+      m_sellSide.prefetch(price);
+    }
+  }
+
+  // an add trades with the other side first, and only what's left of it
+  // rests - an order that trades away completely is never in the book
+  template <Direction dir, typename OwnSide, typename OtherSide,
+            typename FillsCallback>
+  Result apply(const OrderAction<Action::Add, dir> &oaction, OwnSide &own,
+               OtherSide &other, FillsCallback &cb);
+
+  template <Action action, Direction dir, typename OwnSide,
+            typename OtherSide, typename FillsCallback>
+  Result apply(const OrderAction<action, dir> &oaction, OwnSide &own,
+               OtherSide &other, FillsCallback &cb);
+
+  // orders that never rest, see Action. All they do to the book is take
+  // orders off the other side, their own side isn't touched.
+  template <Direction dir, typename OwnSide, typename OtherSide,
+            typename FillsCallback>
+  Result apply(const OrderAction<Action::Ioc, dir> &oaction, OwnSide &,
+               OtherSide &other, FillsCallback &cb) {
+    return immediate<dir>(oaction.getOid(), oaction.getVolume(),
+                          oaction.getPrice(), other, cb);
+  }
+
+  template <Direction dir, typename OwnSide, typename OtherSide,
+            typename FillsCallback>
+  Result apply(const OrderAction<Action::Fok, dir> &oaction, OwnSide &,
+               OtherSide &other, FillsCallback &cb) {
+    if (!other.canFill(oaction.getVolume(), oaction.getPrice())) {
+      // killed, having changed nothing - unless it's turned down
+      return nullptr == m_index.find(oaction.getOid())
+                 ? Result::Ok
+                 : Result::DuplicateOrderId;
+    }
+    return immediate<dir>(oaction.getOid(), oaction.getVolume(),
+                          oaction.getPrice(), other, cb);
+  }
+
+  template <Direction dir, typename OwnSide, typename OtherSide,
+            typename FillsCallback>
+  Result apply(const OrderAction<Action::Market, dir> &oaction, OwnSide &,
+               OtherSide &other, FillsCallback &cb) {
+    return immediate<dir>(oaction.getOid(), oaction.getVolume(),
+                          Direction::Buy == dir
+                              ? std::numeric_limits<uint32_t>::max()
+                              : 0u,
+                          other, cb);
+  }
 
+  // trades what it can at up to price, and drops the rest. The oid can't be
+  // one that's resting, for the trades to make sense.
+  template <Direction dir, typename OtherSide, typename FillsCallback>
+  Result immediate(uint32_t oid, uint32_t volume, uint32_t price,
+                   OtherSide &other, FillsCallback &cb) {
+    if (unlikely(nullptr != m_index.find(oid))) {
+      return Result::DuplicateOrderId;
+    }
+    fill<dir>(oid, volume, price, other, cb);
+    return Result::Ok;
+  }
+
+  // an order coming in on dir's side, against the other side. Returns what's
+  // left of the volume.
+  template <Direction dir, typename OtherSide, typename FillsCallback>
+  uint32_t fill(uint32_t oid, uint32_t volume, uint32_t price,
+                OtherSide &other, FillsCallback &cb) {
+    return other.take(
+        volume, price,
+        [oid, &cb](uint32_t resting, uint32_t traded, uint32_t at) {
+          const Trade trade(Direction::Buy == dir ? oid : resting,
+                            Direction::Buy == dir ? resting : oid, traded,
+                            at);
+          cb(trade);
+        });
+  }
+
+public:
+  // shared by both sides, so need to be constructed before them
+  OrderIndex m_index;
+  OrderPool m_pool;
+  LevelChanges m_changes;
   BuySide m_buySide;
   SellSide m_sellSide;
 };
 
-template <Direction direction>
-void OrderSide<direction>::handle(
+using OrderBook = BasicOrderBook<MapLadder>;
+using ArrayOrderBook = BasicOrderBook<ArrayLadder>;
+
+template <Direction direction, template <Direction> class Ladder>
+Result OrderSide<direction, Ladder>::handle(
     const OrderAction<Action::Add, direction> &oaction) {
-  auto &vct = MapT::operator[](oaction.getPrice());
-  // we don't assume that order ids only go up
-  // otherwise a binary search would have been better
-  auto iter =
-      std::find_if(vct.begin(), vct.end(), [&oaction](const Order &order) {
-        return order.getOid() == oaction.getOid();
-      });
-  if (unlikely(iter != vct.end())) {
-    throw DuplicateOrderIdError(oaction.getOid());
-  } else {
-    vct.emplace_back(oaction);
+  Order *order(m_pool.create(oaction));
+  // the index knows about every resting order on both sides, so this catches
+  // an oid resting at another price or on the other side as well
+  if (unlikely(!m_index.insert(
+          oaction.getOid(),
+          OrderLocation{direction, oaction.getPrice(), order}))) {
+    m_pool.release(order);
+    return Result::DuplicateOrderId;
   }
+  LadderT::operator[](oaction.getPrice()).push_back(order);
+  m_changes.touch(direction, oaction.getPrice());
+  return Result::Ok;
 }
 
-template <Direction direction>
-inline void OrderSide<direction>::handle(
+template <Direction direction, template <Direction> class Ladder>
+inline Result OrderSide<direction, Ladder>::handle(
     const OrderAction<Action::Remove, direction> &oaction) {
-  auto mIter = MapT::find(oaction.getPrice());
-  if (mIter == MapT::end()) {
-    // I don't even know the price .. so I definitely don't know this order.
-    throw UnknownOrderIdError(oaction.getOid());
-  } else {
-    auto &vct = mIter->second;
-    auto iter =
-        std::find_if(vct.begin(), vct.end(), [&oaction](const Order &order) {
-          return order.getOid() == oaction.getOid();
-        });
-    if (iter == vct.end()) {
-      // I know the price but I don't know this order.
-      throw UnknownOrderIdError(oaction.getOid());
-    } else {
-      if (1u == vct.size()) {
-        // whole level taken out
-        MapT::erase(mIter);
-      } else {
-        // this order taken out
-        vct.erase(iter);
-      }
-    }
+  const OrderLocation *location = m_index.find(oaction.getOid());
+  if (unlikely(nullptr == location || location->dir != direction ||
+               location->price != oaction.getPrice())) {
+    // not resting on this side at this price, so as far as this message is
+    // concerned, I don't know the order.
+    return Result::UnknownOrderId;
   }
+  eraseOrder(oaction.getOid(), *location);
+  return Result::Ok;
 }
 
-template <Direction direction>
-void OrderSide<direction>::handle(
+template <Direction direction, template <Direction> class Ladder>
+Result OrderSide<direction, Ladder>::handle(
     const OrderAction<Action::Modify, direction> &oaction) {
-  // find existing
-  bool found(false);
-  for (auto mIter = MapT::begin(); mIter != MapT::end(); mIter++) {
-    auto &vct = mIter->second;
-    auto iter =
-        std::find_if(vct.begin(), vct.end(), [&oaction](const Order &order) {
-          return order.getOid() == oaction.getOid();
-        });
-    // if found, then we delete the level or individual order
-    if (iter != vct.end()) {
-      if (1u == vct.size()) {
-        // whole level taken out
-        MapT::erase(mIter);
-      } else {
-        // this order taken out
-        vct.erase(iter);
-      }
-      found = true;
-      break;
-    }
+  // find existing - if we don't know it on this side, we're done
+  const OrderLocation *location = m_index.find(oaction.getOid());
+  if (unlikely(nullptr == location || location->dir != direction)) {
+    return Result::UnknownOrderId;
   }
-  // if not found, we're done - raise an exception
-  if (!found) {
-    throw UnknownOrderIdError(oaction.getOid());
+
+  // less of it ( or as much ) at the same price keeps its place in the queue,
+  // it's just the order and its level's total that go down
+  Order *order(location->order);
+  if (location->price == oaction.getPrice() && 0u != oaction.getVolume() &&
+      oaction.getVolume() <= order->getVolume()) {
+    if (oaction.getVolume() < order->getVolume()) {
+      LevelT *level = LadderT::find(location->price);
+      // the index only points at levels that exist
+      assert(nullptr != level);
+      level->reduce(*order, order->getVolume() - oaction.getVolume());
+      m_changes.touch(direction, location->price);
+    }
+    return Result::Ok;
   }
 
-  // insert new
-  handle(OrderAction<Action::Add, direction>(
+  // anything else goes to the back of the queue at its new price
+  eraseOrder(oaction.getOid(), *location);
+
+  // insert new - the oid is free again, so this can't be turned down
+  return handle(OrderAction<Action::Add, direction>(
       oaction.getOid(), oaction.getVolume(), oaction.getPrice()));
 }
 
-double OrderBook::getMidPrice() const {
-  auto buyIter = m_buySide.begin();
-  auto sellIter = m_sellSide.begin();
-  return (buyIter != m_buySide.end() && sellIter != m_sellSide.end())
-             ? (buyIter->first + sellIter->first) / 2.0
-             : std::numeric_limits<double>::quiet_NaN();
+template <Direction direction, template <Direction> class Ladder>
+void OrderSide<direction, Ladder>::eraseOrder(
+    uint32_t oid, const OrderLocation &location) noexcept {
+  const uint32_t price(location.price);
+  Order *order(location.order);
+  LevelT *level = LadderT::find(price);
+  // the index only points at levels that exist
+  assert(nullptr != level);
+  level->erase(order);
+  if (level->empty()) {
+    // whole level taken out
+    LadderT::erase(price);
+  }
+  m_changes.touch(direction, price);
+  // the location lives in the index, so it goes last
+  m_index.erase(oid);
+  m_pool.release(order);
 }
 
-template <Action action, typename FillsCallback>
-void OrderBook::handle(const OrderAction<action, Direction::Buy> &oaction,
-                       FillsCallback &cb) {
-  m_buySide.handle(oaction);
+template <Direction direction, template <Direction> class Ladder>
+void OrderSide<direction, Ladder>::reduceFront(uint32_t volume) noexcept {
+  auto front = LadderT::front();
+  auto &orders = front.second;
+  m_changes.touch(direction, front.first);
+  if (volume == orders.front().getVolume()) {
+    Order *order(orders.pop_front());
+    if (orders.empty()) {
+      LadderT::eraseFront();
+    }
+    m_index.erase(order->getOid());
+    m_pool.release(order);
+  } else {
+    orders.reduce(orders.front(), volume);
+  }
+}
 
-  if (Action::Add == action) {
-    match<Direction::Buy, FillsCallback>(cb);
+template <Direction direction, template <Direction> class Ladder>
+template <typename F>
+uint32_t OrderSide<direction, Ladder>::take(uint32_t volume, uint32_t price,
+                                            F &&fill) noexcept {
+  while (0u != volume && crosses(price)) {
+    auto front = LadderT::front();
+    auto &orders = front.second;
+    m_changes.touch(direction, front.first);
+    while (0u != volume && !orders.empty()) {
+      Order &order(orders.front());
+      const uint32_t traded(std::min(volume, order.getVolume()));
+      fill(order.getOid(), traded, front.first);
+      volume -= traded;
+      if (traded == order.getVolume()) {
+        orders.pop_front();
+        m_index.erase(order.getOid());
+        m_pool.release(&order);
+      } else {
+        orders.reduce(order, traded);
+      }
+    }
+    if (orders.empty()) {
+      LadderT::eraseFront();
+    }
   }
+  return volume;
+}
+
+template <template <Direction> class Ladder>
+double BasicOrderBook<Ladder>::getMidPrice() const {
+  return (!m_buySide.empty() && !m_sellSide.empty())
+             ? (m_buySide.front().first + m_sellSide.front().first) / 2.0
+             : std::numeric_limits<double>::quiet_NaN();
+}
+
+template <template <Direction> class Ladder>
+template <Action action, typename FillsCallback>
+Result BasicOrderBook<Ladder>::handle(
+    const OrderAction<action, Direction::Buy> &oaction, FillsCallback &cb) {
+  m_changes.clear();
+  return apply(oaction, m_buySide, m_sellSide, cb);
 }
 
+template <template <Direction> class Ladder>
 template <Action action, typename FillsCallback>
-void OrderBook::handle(const OrderAction<action, Direction::Sell> &oaction,
-                       FillsCallback &cb) {
-  m_sellSide.handle(oaction);
+Result BasicOrderBook<Ladder>::handle(
+    const OrderAction<action, Direction::Sell> &oaction, FillsCallback &cb) {
+  m_changes.clear();
+  return apply(oaction, m_sellSide, m_buySide, cb);
+}
+
+template <template <Direction> class Ladder>
+template <Direction dir, typename OwnSide, typename OtherSide,
+          typename FillsCallback>
+Result
+BasicOrderBook<Ladder>::apply(const OrderAction<Action::Add, dir> &oaction,
+                              OwnSide &own, OtherSide &other,
+                              FillsCallback &cb) {
+  if (likely(!other.crosses(oaction.getPrice()))) {
+    return own.handle(oaction);
+  }
+  // it mustn't trade if it's going to be turned down
+  if (unlikely(nullptr != m_index.find(oaction.getOid()))) {
+    return Result::DuplicateOrderId;
+  }
+  const uint32_t left(fill<dir>(oaction.getOid(), oaction.getVolume(),
+                                oaction.getPrice(), other, cb));
+  if (0u == left) {
+    return Result::Ok;
+  }
+  return own.handle(OrderAction<Action::Add, dir>(oaction.getOid(), left,
+                                                  oaction.getPrice()));
+}
 
-  if (Action::Add == action) {
-    match<Direction::Sell, FillsCallback>(cb);
+template <template <Direction> class Ladder>
+template <Action action, Direction dir, typename OwnSide, typename OtherSide,
+          typename FillsCallback>
+Result BasicOrderBook<Ladder>::apply(const OrderAction<action, dir> &oaction,
+                                     OwnSide &own, OtherSide &,
+                                     FillsCallback &cb) {
+  const Result result(own.handle(oaction));
+  // a modify can cross, if it's been moved to a new price
+  if (Action::Modify == action && likely(Result::Ok == result)) {
+    match<dir, FillsCallback>(cb);
   }
+  return result;
 }
 
+template <template <Direction> class Ladder>
 template <Direction dir, typename FillsCallback>
-void OrderBook::match(FillsCallback &cb) noexcept {
+void BasicOrderBook<Ladder>::match(FillsCallback &cb) noexcept {
   auto isCrossed = [](auto const &buySide, auto const &sellSide) {
     return !buySide.empty() && !sellSide.empty() &&
            buySide.front().first >= sellSide.front().first;
   };
 
-  auto reduceSize = [](auto &side, auto volume) {
-    auto &orders = side.front().second;
-    if (volume == orders.front().getVolume()) {
-      if (1u == orders.size()) {
-        side.erase(side.begin());
-      } else {
-        orders.erase(orders.begin());
-      }
-    } else {
-      orders.front().reduceVolume(volume);
-    }
-  };
-
   while (isCrossed(m_buySide, m_sellSide)) {
 
     auto &buyOrders = m_buySide.front().second;
@@ -224,32 +472,58 @@ void OrderBook::match(FillsCallback &cb) noexcept {
     const Trade trade(buyOid, sellOid, volume, price);
     cb(trade);
 
-    reduceSize(m_buySide, volume);
-    reduceSize(m_sellSide, volume);
+    m_buySide.reduceFront(volume);
+    m_sellSide.reduceFront(volume);
   }
 }
 
-template <Direction direction>
-std::ostream &operator<<(std::ostream &os, const OrderSide<direction> &side) {
+template <template <Direction> class Ladder>
+void BasicOrderBook<Ladder>::restore(Direction dir, uint32_t oid,
+                                     uint32_t volume, uint32_t price) {
+  Result result(Result::BadMessage);
+  switch (dir) {
+  case Direction::Buy:
+    result = m_buySide.handle(
+        OrderAction<Action::Add, Direction::Buy>(oid, volume, price));
+    break;
+  case Direction::Sell:
+    result = m_sellSide.handle(
+        OrderAction<Action::Add, Direction::Sell>(oid, volume, price));
+    break;
+  default:
+    break;
+  }
+  throwOnError(result, 0, oid);
+  // nobody's asking for updates while a book gets loaded, so don't let the
+  // levels pile up
+  m_changes.clear();
+}
 
-  auto getVolume = [](const std::vector<Order> &orders) {
-    uint32_t volume(0);
-    assert(std::distance(orders.begin(), orders.end()) != 0);
-    std::for_each(orders.begin(), orders.end(), [&volume](const Order &order) {
-      volume += order.getVolume();
-    });
-    return volume;
-  };
+template <template <Direction> class Ladder>
+template <typename F>
+void BasicOrderBook<Ladder>::forEachUpdate(F &&f) const {
+  m_changes.forEach([this, &f](Direction dir, uint32_t price) {
+    const Level *level(Direction::Buy == dir ? m_buySide.find(price)
+                                             : m_sellSide.find(price));
+    f(LevelUpdate{dir, price,
+                  nullptr == level ? 0u : static_cast<uint32_t>(level->size()),
+                  nullptr == level ? 0u : level->volume()});
+  });
+}
 
-  for (const auto &pair : side) {
-    const auto price(pair.first);
-    const auto volume(getVolume(pair.second));
-    os << volume << "x" << price << " ";
-  }
+template <Direction direction, template <Direction> class Ladder>
+std::ostream &operator<<(std::ostream &os,
+                         const OrderSide<direction, Ladder> &side) {
+
+  side.forEach([&os](const uint32_t price, const auto &orders) {
+    assert(!orders.empty());
+    os << orders.volume() << "x" << price << " ";
+  });
   return os;
 }
 
-std::ostream &operator<<(std::ostream &os, const OrderBook &book) {
+template <template <Direction> class Ladder>
+std::ostream &operator<<(std::ostream &os, const BasicOrderBook<Ladder> &book) {
   os << " -- book -- " << std::endl;
   os << " -- bid : " << std::endl;
   os << book.getBuySide() << std::endl;
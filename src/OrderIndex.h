@@ -0,0 +1,419 @@
+#ifndef ORDERINDEX_H
+#define ORDERINDEX_H
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <cinttypes>
+#include <new>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Common.h"
+#include "Enums.h"
+
+namespace mvs {
+namespace orderbook {
+
+struct Order;
+
+// where a resting order lives in the book: which side, at which price level,
+// and the order itself - enough to take it out of its level without walking
+// the book.
+struct OrderLocation {
+  Direction dir;
+  uint32_t price;
+  Order *order;
+};
+
+// book-wide oid -> location lookup, shared by both sides of the book so an
+// oid can only ever be resting once. There are two layouts of it, and
+// OrderIndex is the one the books use - see the bottom of this file.
+//
+// It's an open addressing table with linear probing rather than a
+// std::unordered_map: flat arrays, no node per order, and a lookup is usually
+// a single cache line. Oids tend to be handed out sequentially, so they're
+// scattered with a multiplicative ( Fibonacci ) hash to keep dense ranges
+// from piling up in neighbouring slots. How the slots are laid out, and so
+// how a probe goes through them, is up to Storage; which slot an oid ends up
+// in is the same whichever it is.
+template <typename Storage> struct HashIndex {
+  explicit HashIndex(std::size_t capacity = 1024) {
+    std::size_t slots(Storage::minSlots);
+    while (slots < capacity * 2) {
+      slots *= 2;
+    }
+    rehash(slots);
+  }
+  HashIndex(HashIndex &) = delete;
+  HashIndex &operator=(HashIndex &) = delete;
+
+  // returns false if the oid is already known
+  bool insert(const uint32_t oid, const OrderLocation &location) {
+    if (unlikely((m_size + 1) * 2 > m_storage.slots())) {
+      // keep the load factor at or below a half, so probe sequences stay short
+      rehash(m_storage.slots() * 2);
+    }
+    const std::size_t pos(probe(oid));
+    if (m_storage.taken(pos)) {
+      return false;
+    }
+    m_storage.put(pos, oid, location);
+    ++m_size;
+    return true;
+  }
+
+  // returns nullptr if the oid is unknown
+  const OrderLocation *find(const uint32_t oid) const {
+    const std::size_t pos(probe(oid));
+    return unlikely(!m_storage.taken(pos)) ? nullptr
+                                           : &m_storage.location(pos);
+  }
+
+  // starts bringing in the slot a lookup of the oid starts at, without
+  // waiting for it - for batches, see Processor
+  void prefetch(const uint32_t oid) const { m_storage.prefetch(home(oid)); }
+
+  bool contains(const uint32_t oid) const {
+    return m_storage.taken(probe(oid));
+  }
+
+  void erase(const uint32_t oid) {
+    std::size_t pos(probe(oid));
+    if (!m_storage.taken(pos)) {
+      return;
+    }
+    // backward shift deletion: pull later entries of the same cluster into the
+    // hole if that doesn't move them in front of their home slot. No
+    // tombstones, so lookups never slow down as orders come and go.
+    std::size_t next((pos + 1) & m_mask);
+    while (m_storage.taken(next)) {
+      const std::size_t nextHome(home(m_storage.oid(next)));
+      if (((next - nextHome) & m_mask) >= ((next - pos) & m_mask)) {
+        m_storage.move(pos, next);
+        pos = next;
+      }
+      next = (next + 1) & m_mask;
+    }
+    m_storage.release(pos);
+    --m_size;
+  }
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return 0u == m_size; }
+  std::size_t capacity() const { return m_storage.slots() / 2; }
+
+private:
+  std::size_t home(const uint32_t oid) const {
+    return (oid * 2654435769u) >> m_shift;
+  }
+
+  // the slot holding this oid, or the free slot ending its probe sequence
+  std::size_t probe(const uint32_t oid) const {
+    return m_storage.probe(oid, home(oid), m_mask);
+  }
+
+  void rehash(const std::size_t slots) {
+    Storage old(slots);
+    old.swap(m_storage);
+    m_mask = slots - 1;
+    m_shift = 32;
+    for (std::size_t n = slots; n > 1; n /= 2) {
+      --m_shift;
+    }
+    m_size = 0;
+    for (std::size_t pos = 0; pos < old.slots(); ++pos) {
+      if (old.taken(pos)) {
+        insert(old.oid(pos), old.location(pos));
+      }
+    }
+  }
+
+  Storage m_storage;
+  std::size_t m_mask = 0;
+  unsigned m_shift = 32;
+  std::size_t m_size = 0;
+};
+
+namespace details {
+
+// one array of 24 byte slots, an oid with its location, probed a slot at a
+// time. An oid that's found has its location in the same cache line.
+struct SlotStorage {
+  static constexpr std::size_t minSlots = 16;
+
+  explicit SlotStorage(std::size_t slots = 0)
+      : m_slots(slots, Slot{0, OrderLocation{emptyDir, 0, nullptr}}) {}
+
+  std::size_t slots() const { return m_slots.size(); }
+  bool taken(std::size_t pos) const {
+    return m_slots[pos].location.dir != emptyDir;
+  }
+  uint32_t oid(std::size_t pos) const { return m_slots[pos].oid; }
+  const OrderLocation &location(std::size_t pos) const {
+    return m_slots[pos].location;
+  }
+
+  void put(std::size_t pos, uint32_t oid, const OrderLocation &location) {
+    assert(location.dir != emptyDir);
+    m_slots[pos] = Slot{oid, location};
+  }
+  void move(std::size_t to, std::size_t from) { m_slots[to] = m_slots[from]; }
+  void release(std::size_t pos) { m_slots[pos].location.dir = emptyDir; }
+  void prefetch(std::size_t pos) const { __builtin_prefetch(&m_slots[pos]); }
+
+  std::size_t probe(const uint32_t oid, std::size_t pos,
+                    std::size_t mask) const {
+    while (taken(pos) && m_slots[pos].oid != oid) {
+      pos = (pos + 1) & mask;
+    }
+    return pos;
+  }
+
+  void swap(SlotStorage &other) { m_slots.swap(other.m_slots); }
+
+private:
+  // valid directions are 'B' and 'S', so a zero direction marks a free slot
+  static constexpr Direction emptyDir = static_cast<Direction>(0);
+
+  struct Slot {
+    uint32_t oid;
+    OrderLocation location;
+  };
+
+  std::vector<Slot> m_slots;
+};
+
+} // namespace details
+
+// how many oids GroupedIndex compares at once, and what with. Which one there
+// is gets found out when the program starts, see simdLevel().
+enum class Simd { Scalar, Sse2, Avx2 };
+
+namespace details {
+
+constexpr std::size_t oidGroup = 8;
+
+// a bit for each of the oidGroup oids at oids that's equal to oid. oids is
+// aligned to the group.
+inline uint32_t matchScalar(const uint32_t *oids, uint32_t oid) {
+  uint32_t mask(0);
+  for (std::size_t lane = 0; lane < oidGroup; ++lane) {
+    mask |= static_cast<uint32_t>(oids[lane] == oid) << lane;
+  }
+  return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) inline uint32_t
+matchSse2(const uint32_t *oids, uint32_t oid) {
+  const __m128i key(_mm_set1_epi32(static_cast<int>(oid)));
+  const __m128i low(_mm_cmpeq_epi32(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(oids)), key));
+  const __m128i high(_mm_cmpeq_epi32(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(oids + 4)), key));
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(low))) |
+         static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(high))) << 4;
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+matchAvx2(const uint32_t *oids, uint32_t oid) {
+  const __m256i equal(_mm256_cmpeq_epi32(
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(oids)),
+      _mm256_set1_epi32(static_cast<int>(oid))));
+  return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(equal)));
+}
+#endif
+
+inline Simd detectSimd() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return Simd::Avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return Simd::Sse2;
+  }
+#endif
+  return Simd::Scalar;
+}
+
+// set before main, so every thread reads them without a guard. The level in
+// use only ever changes in tests, see forceSimd().
+template <typename = void> struct SimdSupport {
+  static const Simd supported;
+  static Simd level;
+};
+template <typename T> const Simd SimdSupport<T>::supported = detectSimd();
+template <typename T> Simd SimdSupport<T>::level = detectSimd();
+
+// an allocator handing out memory aligned to a cache line, so a group of
+// oids is a single aligned load that never straddles two lines
+template <typename T> struct LineAllocator {
+  using value_type = T;
+  static constexpr std::size_t alignment = 64;
+
+  LineAllocator() = default;
+  template <typename U> LineAllocator(const LineAllocator<U> &) {}
+
+  T *allocate(std::size_t n) {
+    void *p(nullptr);
+    if (0 != posix_memalign(&p, alignment, n * sizeof(T))) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+  void deallocate(T *p, std::size_t) { free(p); }
+  bool operator==(const LineAllocator &) const { return true; }
+  bool operator!=(const LineAllocator &) const { return false; }
+};
+
+} // namespace details
+
+// what the CPU has
+inline Simd simdSupported() { return details::SimdSupport<>::supported; }
+
+// what GroupedIndex compares oids with
+inline Simd simdLevel() { return details::SimdSupport<>::level; }
+
+// for tests, so every way of probing gets to go through inserts, erases and
+// rehashes, not just the best one the CPU has. Only while no other thread
+// uses an index.
+inline void forceSimd(Simd level) {
+  assert(level <= simdSupported());
+  details::SimdSupport<>::level = level;
+}
+
+namespace details {
+
+// arrays rather than slots: the oids next to each other, their locations
+// alongside, and a bit per slot for whether it's taken. A probe goes through
+// a group of 8 oids at a time - one compare with AVX2, two with SSE2, or a
+// loop where there's neither - and only touches a location once it's found
+// the oid.
+//
+// That makes an oid that isn't there cheaper to find out about, 16 oids to a
+// cache line, but one that is costs a second line for its location, which a
+// slot has right next to the oid. It pays off where most lookups miss - e.g.
+// cancels for orders that have mostly traded already - and the oids stay in
+// cache: a miss takes about half as long as with slots for a thousand
+// resting orders. A hit takes two or three times as long, and adding and
+// removing orders is no faster, so the books use slots unless they're built
+// with ORDERBOOK_GROUPED_INDEX - see BM_Index* in the benchmarks.
+struct GroupedStorage {
+  // a whole number of groups, and of words of the bitmap
+  static constexpr std::size_t minSlots = 64;
+
+  explicit GroupedStorage(std::size_t slots = 0)
+      : m_oids(slots, 0), m_locations(slots), m_taken(slots / 64, 0) {}
+
+  std::size_t slots() const { return m_oids.size(); }
+  bool taken(std::size_t pos) const {
+    return m_taken[pos / 64] & (uint64_t(1) << (pos % 64));
+  }
+  uint32_t oid(std::size_t pos) const { return m_oids[pos]; }
+  const OrderLocation &location(std::size_t pos) const {
+    return m_locations[pos];
+  }
+
+  void put(std::size_t pos, uint32_t oid, const OrderLocation &location) {
+    m_oids[pos] = oid;
+    m_locations[pos] = location;
+    m_taken[pos / 64] |= uint64_t(1) << (pos % 64);
+  }
+  void move(std::size_t to, std::size_t from) {
+    m_oids[to] = m_oids[from];
+    m_locations[to] = m_locations[from];
+  }
+  void release(std::size_t pos) {
+    m_taken[pos / 64] &= ~(uint64_t(1) << (pos % 64));
+  }
+  void prefetch(std::size_t pos) const {
+    __builtin_prefetch(&m_oids[pos]);
+    __builtin_prefetch(&m_locations[pos]);
+  }
+
+  std::size_t probe(const uint32_t oid, std::size_t pos,
+                    std::size_t mask) const {
+    // most oids are at home, so the location can be on its way while the
+    // oids are being compared
+    __builtin_prefetch(&m_locations[pos]);
+    switch (simdLevel()) {
+#if defined(__x86_64__) || defined(__i386__)
+    case Simd::Avx2:
+      return probeAvx2(oid, pos, mask);
+    case Simd::Sse2:
+      return probeSse2(oid, pos, mask);
+#endif
+    default:
+      return probeWith(oid, pos, mask, matchScalar);
+    }
+  }
+
+  void swap(GroupedStorage &other) {
+    m_oids.swap(other.m_oids);
+    m_locations.swap(other.m_locations);
+    m_taken.swap(other.m_taken);
+  }
+
+private:
+  static constexpr std::size_t group = oidGroup;
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2"))) std::size_t
+  probeAvx2(const uint32_t oid, std::size_t pos, std::size_t mask) const {
+    return probeWith(oid, pos, mask, matchAvx2);
+  }
+  __attribute__((target("sse2"))) std::size_t
+  probeSse2(const uint32_t oid, std::size_t pos, std::size_t mask) const {
+    return probeWith(oid, pos, mask, matchSse2);
+  }
+#endif
+
+  // a group at a time, starting with the one home is in: the first slot from
+  // home on that's either this oid or free is the same slot a probe one slot
+  // at a time would stop at
+  template <typename Match>
+  __attribute__((always_inline)) std::size_t
+  probeWith(const uint32_t oid, std::size_t pos, std::size_t mask,
+            Match match) const {
+    std::size_t first(pos & ~(group - 1));
+    // the slots in front of home in its group don't count
+    uint32_t from(~uint32_t(0) << (pos - first));
+    while (true) {
+      const uint32_t taken(
+          static_cast<uint32_t>(m_taken[first / 64] >> (first % 64)) & 0xffu);
+      const uint32_t stop(((match(&m_oids[first], oid) & taken) | ~taken) &
+                          from & 0xffu);
+      if (likely(0u != stop)) {
+        return first + __builtin_ctz(stop);
+      }
+      first = (first + group) & mask;
+      from = ~uint32_t(0);
+    }
+  }
+
+  std::vector<uint32_t, LineAllocator<uint32_t>> m_oids;
+  std::vector<OrderLocation> m_locations;
+  std::vector<uint64_t> m_taken;
+};
+
+} // namespace details
+
+using SlotIndex = HashIndex<details::SlotStorage>;
+using GroupedIndex = HashIndex<details::GroupedStorage>;
+
+// the layout the books use, see 'make build-grouped-index'
+#ifdef ORDERBOOK_GROUPED_INDEX
+using OrderIndex = GroupedIndex;
+#else
+using OrderIndex = SlotIndex;
+#endif
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // ORDERINDEX_H
@@ -0,0 +1,48 @@
+#ifndef ORDERPOOL_H
+#define ORDERPOOL_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+#include "Actions.h"
+#include "BlockPool.h"
+#include "Order.h"
+
+namespace mvs {
+namespace orderbook {
+
+// hands out Orders from a BlockPool. Once the pool has grown to the number of
+// orders the book holds at its busiest, it doesn't allocate any more - or at
+// all, if it was given that number up front. Orders never move while they're
+// alive, so pointers to them stay valid until they're released.
+struct OrderPool {
+  // orders that are still in use when the pool goes away just go with the
+  // slabs, nothing gets destroyed one by one
+  static_assert(std::is_trivially_destructible<Order>::value,
+                "orders don't get destroyed individually");
+
+  explicit OrderPool(std::size_t capacity = 1024)
+      : m_blocks(capacity, sizeof(Order)) {}
+  OrderPool(OrderPool &) = delete;
+  OrderPool &operator=(OrderPool &) = delete;
+
+  template <Direction dir>
+  Order *create(const OrderAction<Action::Add, dir> &oaction) {
+    return new (m_blocks.allocate(sizeof(Order))) Order(oaction);
+  }
+
+  void release(Order *order) noexcept { m_blocks.deallocate(order); }
+
+  // number of orders handed out, and the number there's room for
+  std::size_t size() const { return m_blocks.size(); }
+  std::size_t capacity() const { return m_blocks.capacity(); }
+
+private:
+  BlockPool m_blocks;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // ORDERPOOL_H
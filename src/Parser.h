@@ -0,0 +1,212 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <ostream>
+
+#include "Common.h"
+#include "Enums.h"
+#include "Exceptions.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the digit conversion assumes a little endian machine"
+#endif
+
+namespace mvs {
+namespace orderbook {
+
+// one line of input, taken apart. Remove doesn't have a volume and Market
+// doesn't have a price, so those are 0.
+struct Message {
+  Action action;
+  Direction dir;
+  uint32_t oid;
+  uint32_t volume;
+  uint32_t price;
+  // which book it's for, see BookManager
+  uint16_t symbol;
+};
+
+// back to text, the way it'd be in an input file
+inline std::ostream &operator<<(std::ostream &os, const Message &message) {
+  if (0u != message.symbol) {
+    os << message.symbol << ',';
+  }
+  os << static_cast<char>(message.action) << ',' << message.oid << ','
+     << static_cast<char>(message.dir) << ',';
+  if (Action::Remove != message.action) {
+    os << message.volume;
+    if (Action::Market == message.action) {
+      return os;
+    }
+    os << ',';
+  }
+  return os << message.price;
+}
+
+namespace details {
+
+inline bool isDigit(char c) {
+  return static_cast<unsigned char>(c - '0') < 10u;
+}
+
+// eight digits at once, the first ( most significant ) one in the lowest byte
+// and already turned into 0 .. 9 - see Lemire's "Fast float parsing in
+// practice". Pairs, then quads, then the lot.
+inline uint32_t convertDigits(uint64_t digits) {
+  digits = (digits * 10) + (digits >> 8);
+  digits = (((digits & 0x000000FF000000FFull) * 0x000F424000000064ull) +
+            (((digits >> 16) & 0x000000FF000000FFull) *
+             0x0000271000000001ull)) >>
+           32;
+  return static_cast<uint32_t>(digits);
+}
+
+// walks through a line once, front to back. Unlike strtok it keeps all of its
+// state to itself, so any number of them can be going at the same time, and
+// it doesn't need the line to be null terminated or writable.
+struct Cursor {
+  Cursor(const char *line, std::size_t length)
+      : m_line(line), m_pos(line), m_end(line + length) {}
+
+  // a single character followed by a comma
+  char character() {
+    if (unlikely(m_end - m_pos < 2 || ',' != m_pos[1])) {
+      fail();
+    }
+    const char c(*m_pos);
+    m_pos += 2;
+    return c;
+  }
+
+  // up to eight digits get converted in one go, a uint32_t has at most ten
+  uint32_t number() {
+    const std::size_t left(static_cast<std::size_t>(m_end - m_pos));
+    // anything past the end of the line reads as 0 bytes, which aren't digits
+    uint64_t chunk(0);
+    if (likely(left >= sizeof(chunk))) {
+      memcpy(&chunk, m_pos, sizeof(chunk));
+    } else {
+      memcpy(&chunk, m_pos, left);
+    }
+    chunk ^= 0x3030303030303030ull;
+    // digits are 0 .. 9 now, so any byte that's 10 or more isn't one. The top
+    // bit is masked off before adding so nothing carries into the next byte.
+    const uint64_t notDigits(
+        (((chunk & 0x7F7F7F7F7F7F7F7Full) + 0x7676767676767676ull) | chunk) &
+        0x8080808080808080ull);
+    const unsigned digits(0u == notDigits ? 8u
+                                          : __builtin_ctzll(notDigits) / 8u);
+    if (unlikely(0u == digits)) {
+      fail();
+    }
+    // shifting up makes room for leading zeroes
+    uint64_t value(convertDigits(chunk << (8u * (8u - digits))));
+    m_pos += digits;
+    if (unlikely(8u == digits)) {
+      for (; m_pos != m_end && isDigit(*m_pos); ++m_pos) {
+        value = value * 10u + static_cast<uint32_t>(*m_pos - '0');
+        if (unlikely(value > std::numeric_limits<uint32_t>::max())) {
+          fail();
+        }
+      }
+    }
+    return static_cast<uint32_t>(value);
+  }
+
+  void comma() {
+    if (unlikely(m_pos == m_end || ',' != *m_pos)) {
+      fail();
+    }
+    ++m_pos;
+  }
+
+  // there can be whitespace and a // comment after the last field, but
+  // nothing else
+  void finish() {
+    while (m_pos != m_end &&
+           (' ' == *m_pos || '\t' == *m_pos || '\r' == *m_pos)) {
+      ++m_pos;
+    }
+    if (unlikely(m_pos != m_end && '/' != *m_pos)) {
+      fail();
+    }
+  }
+
+  [[noreturn]] void fail() const {
+    throw ParseError(m_line, static_cast<std::size_t>(m_end - m_line));
+  }
+
+private:
+  const char *m_line;
+  const char *m_pos;
+  const char *m_end;
+};
+
+} // namespace details
+
+// A,oid,side,volume,price  add
+// M,oid,side,volume,price  modify
+// X,oid,side,price         remove
+// I,oid,side,volume,price  immediate or cancel
+// F,oid,side,volume,price  fill or kill
+// K,oid,side,volume        market
+//
+// optionally with a symbol id in front, e.g. 12,A,oid,side,volume,price -
+// without one it's symbol 0. The line doesn't have to be null terminated.
+// Throws a ParseError with the line in it for anything else.
+inline Message parseMessage(const char *line, std::size_t length) {
+  details::Cursor cursor(line, length);
+  Message message;
+  message.symbol = 0;
+  // actions are letters, so there's no mistaking a symbol for one
+  if (0u != length && details::isDigit(*line)) {
+    const uint32_t symbol(cursor.number());
+    if (unlikely(symbol > std::numeric_limits<uint16_t>::max())) {
+      cursor.fail();
+    }
+    message.symbol = static_cast<uint16_t>(symbol);
+    cursor.comma();
+  }
+  message.action = static_cast<Action>(cursor.character());
+  switch (message.action) {
+  case Action::Add:
+  case Action::Modify:
+  case Action::Remove:
+  case Action::Ioc:
+  case Action::Fok:
+  case Action::Market:
+    break;
+  default:
+    cursor.fail();
+  }
+  message.oid = cursor.number();
+  cursor.comma();
+  message.dir = static_cast<Direction>(cursor.character());
+  if (unlikely(Direction::Buy != message.dir &&
+               Direction::Sell != message.dir)) {
+    cursor.fail();
+  }
+  if (Action::Remove == message.action) {
+    message.volume = 0;
+  } else if (Action::Market == message.action) {
+    message.volume = cursor.number();
+    message.price = 0;
+    cursor.finish();
+    return message;
+  } else {
+    message.volume = cursor.number();
+    cursor.comma();
+  }
+  message.price = cursor.number();
+  cursor.finish();
+  return message;
+}
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // PARSER_H
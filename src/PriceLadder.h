@@ -0,0 +1,380 @@
+#ifndef PRICELADDER_H
+#define PRICELADDER_H
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <functional>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "BlockPool.h"
+#include "Common.h"
+#include "Enums.h"
+#include "Level.h"
+
+namespace mvs {
+namespace orderbook {
+
+// A price ladder keeps the levels of one side of the book, best price first.
+// OrderSide sits on top of one of these, and doesn't care which:
+//
+//   LevelT &operator[](price)  level at this price, created if it doesn't
+//                              exist yet ( the caller puts an order in it )
+//   LevelT *find(price)        nullptr if there's no level at this price,
+//                              const or not
+//   erase(price), eraseFront() take out a level that's run empty
+//   front()                    best price and its level, as a pair
+//   size(), empty()            number of levels
+//   forEach(f)                 f(price, level) for each level, best first
+//   forEachWhile(f)            the same, until f returns false
+//   prefetch(price)            starts bringing in the level at this price,
+//                              if that can be done without waiting on it
+
+template <Direction direction> struct MapType {};
+
+// the maps take their nodes from a pool, so a level that comes and goes
+// doesn't mean a trip to the heap
+using LevelAllocator = PoolAllocator<std::pair<const uint32_t, Level>>;
+
+// buy orders are stored in a map that has the highest price first
+template <> struct MapType<Direction::Buy> {
+  using CompareT = std::greater<uint32_t>;
+  using value_type = std::map<uint32_t, Level, CompareT, LevelAllocator>;
+};
+
+// sell orders are stored in a map that has the lowest price first
+template <> struct MapType<Direction::Sell> {
+  using CompareT = std::less<uint32_t>;
+  using value_type = std::map<uint32_t, Level, CompareT, LevelAllocator>;
+};
+
+// levels in a tree, keyed by price
+template <Direction direction> struct MapLadder {
+  using MapT = typename MapType<direction>::value_type;
+  using LevelT = typename MapT::mapped_type;
+  using value_type = std::pair<uint32_t, LevelT &>;
+  using const_value_type = std::pair<uint32_t, const LevelT &>;
+
+  // levels is the number of levels to make room for up front
+  explicit MapLadder(std::size_t levels = 256)
+      : m_nodes(levels),
+        m_levels(typename MapType<direction>::CompareT(),
+                 LevelAllocator(m_nodes)) {}
+  MapLadder(MapLadder &) = delete;
+  MapLadder &operator=(MapLadder &) = delete;
+
+  LevelT &operator[](uint32_t price) { return m_levels[price]; }
+
+  LevelT *find(uint32_t price) {
+    auto iter = m_levels.find(price);
+    return iter == m_levels.end() ? nullptr : &iter->second;
+  }
+  const LevelT *find(uint32_t price) const {
+    return const_cast<MapLadder *>(this)->find(price);
+  }
+
+  void erase(uint32_t price) { m_levels.erase(price); }
+  void eraseFront() {
+    assert(!empty());
+    m_levels.erase(m_levels.begin());
+  }
+
+  value_type front() {
+    assert(!empty());
+    return value_type(m_levels.begin()->first, m_levels.begin()->second);
+  }
+  const_value_type front() const {
+    assert(!empty());
+    return const_value_type(m_levels.begin()->first, m_levels.begin()->second);
+  }
+
+  std::size_t size() const { return m_levels.size(); }
+  bool empty() const { return m_levels.empty(); }
+
+  template <typename F> void forEach(F &&f) const {
+    for (const auto &pair : m_levels) {
+      f(pair.first, pair.second);
+    }
+  }
+
+  template <typename F> void forEachWhile(F &&f) const {
+    for (const auto &pair : m_levels) {
+      if (!f(pair.first, pair.second)) {
+        return;
+      }
+    }
+  }
+
+  // a node is only found by walking the tree down to it, and that's waiting
+  // on every node along the way - nothing to start early
+  void prefetch(uint32_t) const {}
+
+private:
+  BlockPool m_nodes;
+  MapT m_levels;
+};
+
+// levels in a flat array indexed by tick, for a window of prices around the
+// touch. Finding a level is an array lookup, and the best level is tracked as
+// orders come and go, with a bitmap of occupied ticks to skip over gaps when
+// the best level runs empty.
+//
+// Prices that fall outside the window go into a map. If the market moves
+// through the window - a price better than anything it covers comes in, or
+// the window runs empty - the window gets re-centred on the new touch, and
+// levels move between the array and the map accordingly.
+template <Direction direction> struct ArrayLadder {
+  using MapT = typename MapType<direction>::value_type;
+  using LevelT = typename MapT::mapped_type;
+  using value_type = std::pair<uint32_t, LevelT &>;
+  using const_value_type = std::pair<uint32_t, const LevelT &>;
+
+  // number of ticks covered by the window, and the part of that which is
+  // kept free for better prices when re-centring
+  static constexpr uint32_t windowTicks = 4096;
+  static constexpr uint32_t headroomTicks = windowTicks / 4;
+
+  // levels is the number of levels to make room for up front in the map
+  explicit ArrayLadder(std::size_t levels = 256)
+      : m_levels(windowTicks), m_occupied(windowTicks / 64, 0),
+        m_nodes(levels),
+        m_overflow(typename MapType<direction>::CompareT(),
+                   LevelAllocator(m_nodes)) {}
+  ArrayLadder(ArrayLadder &) = delete;
+  ArrayLadder &operator=(ArrayLadder &) = delete;
+
+  LevelT &operator[](uint32_t price) {
+    const uint32_t rank(toRank(price));
+    if (unlikely(!inWindow(rank))) {
+      if (0u == m_count || rank < m_origin) {
+        // nothing in the window, or the market moved past its best end
+        recentre(rank);
+      } else {
+        return m_overflow[price];
+      }
+    }
+    const uint32_t idx(rank - m_origin);
+    if (!isOccupied(idx)) {
+      setOccupied(idx);
+      ++m_count;
+      m_best = std::min(m_best, idx);
+    }
+    return m_levels[idx];
+  }
+
+  LevelT *find(uint32_t price) {
+    const uint32_t rank(toRank(price));
+    if (likely(inWindow(rank))) {
+      const uint32_t idx(rank - m_origin);
+      return isOccupied(idx) ? &m_levels[idx] : nullptr;
+    }
+    auto iter = m_overflow.find(price);
+    return iter == m_overflow.end() ? nullptr : &iter->second;
+  }
+  const LevelT *find(uint32_t price) const {
+    return const_cast<ArrayLadder *>(this)->find(price);
+  }
+
+  void erase(uint32_t price) {
+    const uint32_t rank(toRank(price));
+    if (unlikely(!inWindow(rank))) {
+      m_overflow.erase(price);
+      return;
+    }
+    const uint32_t idx(rank - m_origin);
+    assert(isOccupied(idx) && m_levels[idx].empty());
+    clearOccupied(idx);
+    --m_count;
+    if (idx == m_best) {
+      m_best = nextOccupied(idx + 1);
+    }
+    if (0u == m_count && !m_overflow.empty()) {
+      // keep the touch in the window
+      recentre(toRank(m_overflow.begin()->first));
+    }
+  }
+  void eraseFront() { erase(front().first); }
+
+  value_type front() {
+    assert(!empty());
+    if (overflowFirst()) {
+      return value_type(m_overflow.begin()->first, m_overflow.begin()->second);
+    }
+    return value_type(toPrice(m_origin + m_best), m_levels[m_best]);
+  }
+  const_value_type front() const {
+    assert(!empty());
+    if (overflowFirst()) {
+      return const_value_type(m_overflow.begin()->first,
+                              m_overflow.begin()->second);
+    }
+    return const_value_type(toPrice(m_origin + m_best), m_levels[m_best]);
+  }
+
+  std::size_t size() const { return m_count + m_overflow.size(); }
+  bool empty() const { return 0u == m_count && m_overflow.empty(); }
+
+  template <typename F> void forEach(F &&f) const {
+    forEachWhile([&f](uint32_t price, const LevelT &level) {
+      f(price, level);
+      return true;
+    });
+  }
+
+  template <typename F> void forEachWhile(F &&f) const {
+    // the map holds prices both better and worse than the window
+    auto iter = m_overflow.begin();
+    for (; iter != m_overflow.end() && toRank(iter->first) < m_origin; ++iter) {
+      if (!f(iter->first, iter->second)) {
+        return;
+      }
+    }
+    for (uint32_t idx = nextOccupied(m_best); idx < windowTicks;
+         idx = nextOccupied(idx + 1)) {
+      if (!f(toPrice(m_origin + idx), m_levels[idx])) {
+        return;
+      }
+    }
+    for (; iter != m_overflow.end(); ++iter) {
+      if (!f(iter->first, iter->second)) {
+        return;
+      }
+    }
+  }
+
+  // inside the window, where the level is is known without looking - the
+  // map beyond it has to be walked, so that's left alone
+  void prefetch(uint32_t price) const {
+    const uint32_t rank(toRank(price));
+    if (likely(inWindow(rank))) {
+      const uint32_t idx(rank - m_origin);
+      __builtin_prefetch(&m_levels[idx]);
+      __builtin_prefetch(&m_occupied[idx / 64]);
+    }
+  }
+
+private:
+  // ranks go up as prices get less aggressive, whichever side we're on - so
+  // index 0 of the window is its best price
+  static uint32_t toRank(uint32_t price) {
+    return Direction::Sell == direction
+               ? price
+               : std::numeric_limits<uint32_t>::max() - price;
+  }
+  static uint32_t toPrice(uint32_t rank) { return toRank(rank); }
+
+  bool inWindow(uint32_t rank) const { return rank - m_origin < windowTicks; }
+
+  // levels only live in the map while the window holds something, so the map
+  // only has the best price if it's better than anything the window covers
+  bool overflowFirst() const {
+    return !m_overflow.empty() && toRank(m_overflow.begin()->first) < m_origin;
+  }
+
+  bool isOccupied(uint32_t idx) const {
+    return m_occupied[idx / 64] & (uint64_t(1) << (idx % 64));
+  }
+  void setOccupied(uint32_t idx) {
+    m_occupied[idx / 64] |= uint64_t(1) << (idx % 64);
+  }
+  void clearOccupied(uint32_t idx) {
+    m_occupied[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+  }
+
+  // first occupied index at or after idx, or windowTicks if there is none
+  uint32_t nextOccupied(uint32_t idx) const {
+    if (idx >= windowTicks) {
+      return windowTicks;
+    }
+    std::size_t word(idx / 64);
+    uint64_t bits(m_occupied[word] & (~uint64_t(0) << (idx % 64)));
+    while (0u == bits) {
+      if (++word == m_occupied.size()) {
+        return windowTicks;
+      }
+      bits = m_occupied[word];
+    }
+    return word * 64 + __builtin_ctzll(bits);
+  }
+
+  // moves the window so that this rank is just inside it, with room for
+  // better prices in front of it. Levels that drop out of the window go into
+  // the map, and levels in the map that are now covered come out of it.
+  void recentre(uint32_t rank) {
+    const uint32_t maxOrigin(std::numeric_limits<uint32_t>::max() -
+                             windowTicks + 1);
+    const uint32_t origin(
+        std::min(rank < headroomTicks ? 0u : rank - headroomTicks, maxOrigin));
+
+    if (0u != m_count) {
+      if (origin > m_origin) {
+        const uint32_t shift(std::min(origin - m_origin, windowTicks));
+        for (uint32_t idx = nextOccupied(0); idx < shift;
+             idx = nextOccupied(idx + 1)) {
+          m_overflow.emplace(toPrice(m_origin + idx), std::move(m_levels[idx]));
+        }
+        std::move(m_levels.begin() + shift, m_levels.end(), m_levels.begin());
+      } else {
+        const uint32_t shift(std::min(m_origin - origin, windowTicks));
+        for (uint32_t idx = nextOccupied(windowTicks - shift);
+             idx < windowTicks; idx = nextOccupied(idx + 1)) {
+          m_overflow.emplace(toPrice(m_origin + idx), std::move(m_levels[idx]));
+        }
+        std::move_backward(m_levels.begin(), m_levels.end() - shift,
+                           m_levels.end());
+      }
+    }
+    m_origin = origin;
+
+    // pull in what the map has inside the new window
+    for (auto iter = m_overflow.begin(); iter != m_overflow.end();) {
+      const uint32_t iterRank(toRank(iter->first));
+      if (iterRank < m_origin) {
+        ++iter;
+      } else if (inWindow(iterRank)) {
+        m_levels[iterRank - m_origin] = std::move(iter->second);
+        iter = m_overflow.erase(iter);
+      } else {
+        break;
+      }
+    }
+
+    // the moved-from levels are empty, so occupancy follows from the levels
+    m_count = 0;
+    m_best = windowTicks;
+    for (uint32_t idx = 0; idx < windowTicks; ++idx) {
+      if (m_levels[idx].empty()) {
+        clearOccupied(idx);
+      } else {
+        setOccupied(idx);
+        ++m_count;
+        m_best = std::min(m_best, idx);
+      }
+    }
+  }
+
+  std::vector<LevelT> m_levels;
+  std::vector<uint64_t> m_occupied;
+  // rank of m_levels[0]
+  uint32_t m_origin = 0;
+  // index of the best occupied level, or windowTicks if there is none
+  uint32_t m_best = windowTicks;
+  // number of occupied levels in the window
+  uint32_t m_count = 0;
+  BlockPool m_nodes;
+  MapT m_overflow;
+};
+
+template <Direction direction>
+constexpr uint32_t ArrayLadder<direction>::windowTicks;
+template <Direction direction>
+constexpr uint32_t ArrayLadder<direction>::headroomTicks;
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // PRICELADDER_H
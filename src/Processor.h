@@ -1,67 +1,50 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
-#include <cstring>
-#include <sstream>
 #include <string>
-#include <type_traits>
 
 #include "Actions.h"
+#include "BinaryFeed.h"
+#include "BookManager.h"
 #include "Common.h"
 #include "Exceptions.h"
 #include "OrderBook.h"
+#include "Parser.h"
 
 namespace mvs {
 namespace orderbook {
 
 namespace details {
 
-// C-style tokenizing using strtok is just faster than out of the box C++
-// solutions. So, we do that here .. but still wrap it up in C++ exceptions, and
-// make it look pretty by using templates.
-
-template <typename T>
-typename std::enable_if<
-    std::is_unsigned<T>::value && std::is_integral<T>::value, T>::type
-parse(const char *input) {
-  T output(0);
-  while (input) {
-    const char c = *(input++);
-    if (c == ' ' || c == '\r' || c == '\0') {
-      return output;
-    } else if (unlikely(c < '0' || c > '9')) {
-      throw ParseError("invalid number");
-    } else {
-      output *= 10;
-      output += (c - '0');
-    }
-  }
-  return output;
+// the book a message for the symbol goes to, nullptr if there isn't one. A
+// book on its own is symbol 0, and only that.
+template <typename BookT> BookT *route(BookT &book, uint16_t symbol) {
+  return likely(0u == symbol) ? &book : nullptr;
 }
 
-template <typename T>
-typename std::enable_if<
-    std::is_unsigned<T>::value && std::is_integral<T>::value, T>::type
-tokenize() {
-  char *token = strtok(nullptr, ",/");
-  if (nullptr == token) {
-    throw ParseError();
-  }
-  return parse<T>(token);
+template <typename BookT>
+BookT *route(BookManager<BookT> &books, uint16_t symbol) {
+  return &books[symbol];
 }
 
-template <typename T>
-typename std::enable_if<std::is_enum<T>::value, T>::type
-tokenize(char *ptr = nullptr) {
-  char *token = strtok(ptr, ",/");
-  if (nullptr == token) {
-    throw ParseError();
-  }
-  return static_cast<T>(*token);
+// the same, only without making a book that isn't there yet - for looking
+// ahead, which mustn't change anything
+template <typename BookT>
+const BookT *peek(const BookT &book, uint16_t symbol) {
+  return likely(0u == symbol) ? &book : nullptr;
+}
+
+template <typename BookT>
+const BookT *peek(const BookManager<BookT> &books, uint16_t symbol) {
+  return books.find(symbol);
 }
 
-} // namespace tokenizer
+} // namespace details
 
+// BookT is a single book, or a BookManager routing messages to a book per
+// symbol. A message that's turned down comes back as anything but Ok rather
+// than throwing - they're routine, e.g. cancels for orders that have already
+// traded. Only a line that doesn't parse throws, a ParseError.
 template <typename BookT = OrderBook> struct Processor {
   using SelfT = Processor<BookT>;
   Processor(BookT &book) : m_book(book) {}
@@ -69,82 +52,178 @@ template <typename BookT = OrderBook> struct Processor {
   Processor operator=(SelfT &) = delete;
 
   template <Action action, typename FillsCallback>
-  void process(const uint32_t oid, const Direction dir, const uint32_t volume,
-               const uint32_t price, FillsCallback &cb);
+  Result process(const uint16_t symbol, const uint32_t oid,
+                 const Direction dir, const uint32_t volume,
+                 const uint32_t price, FillsCallback &cb);
 
+  template <Action action, typename FillsCallback>
+  Result process(const uint32_t oid, const Direction dir,
+                 const uint32_t volume, const uint32_t price,
+                 FillsCallback &cb) {
+    return process<action, FillsCallback>(0, oid, dir, volume, price, cb);
+  }
+
+  // a line that isn't necessarily null terminated, e.g. straight out of a
+  // MappedFile
   template <typename FillsCallback>
-  void process(const std::string &ln, FillsCallback &cb);
+  Result process(const char *line, std::size_t length, FillsCallback &cb) {
+    return process(parseMessage(line, length), cb);
+  }
+
+  template <typename FillsCallback>
+  Result process(const std::string &line, FillsCallback &cb) {
+    return process(line.data(), line.size(), cb);
+  }
+
+  template <typename FillsCallback>
+  Result process(const Message &message, FillsCallback &cb);
+
+  // out of a binary feed, nothing to parse
+  template <typename FillsCallback>
+  Result process(const Record &record, FillsCallback &cb) {
+    return process(toMessage(record), cb);
+  }
+
+  // messages that have already been parsed, one after the other, each the
+  // same as process(message) on its own. While one gets applied, the index
+  // slot and level of the one lookahead messages further on get prefetched,
+  // and halfway there - once its slot is in - the order it's resting as, so
+  // their cache misses overlap with the work rather than coming one after
+  // the other. A lookahead of 0 doesn't prefetch at all.
+  //
+  // Each message's result goes into results, unless that's nullptr. Returns
+  // how many came back Ok.
+  template <typename FillsCallback>
+  std::size_t process(const Message *messages, std::size_t count,
+                      Result *results, FillsCallback &cb,
+                      std::size_t lookahead = defaultLookahead);
+
+  static constexpr std::size_t defaultLookahead = 8;
 
 private:
+  // the two steps of looking ahead, see BasicOrderBook::prefetch
+  void prefetch(const Message &message) const;
+  void prefetchOrder(const Message &message) const;
+
   BookT &m_book;
 };
 
 template <typename BookT>
 template <Action action, typename FillsCallback>
-void Processor<BookT>::process(const uint32_t oid, const Direction dir,
-                               const uint32_t volume, const uint32_t price,
-                               FillsCallback &cb) {
+Result Processor<BookT>::process(const uint16_t symbol, const uint32_t oid,
+                                 const Direction dir, const uint32_t volume,
+                                 const uint32_t price, FillsCallback &cb) {
+  auto *book(details::route(m_book, symbol));
+  if (unlikely(nullptr == book)) {
+    return Result::UnknownSymbol;
+  }
   switch (dir) {
   case Direction::Buy: {
     OrderAction<action, Direction::Buy> oaction(oid, volume, price);
-    m_book.handle(oaction, cb);
-  } break;
+    return book->handle(oaction, cb);
+  }
   case Direction::Sell: {
     OrderAction<action, Direction::Sell> oaction(oid, volume, price);
-    m_book.handle(oaction, cb);
-  } break;
+    return book->handle(oaction, cb);
+  }
   default:
-    throw ParseError("dir mismatch");
-    break;
+    return Result::BadMessage;
   }
 }
 
 template <typename BookT>
 template <typename FillsCallback>
-void Processor<BookT>::process(const std::string &line, FillsCallback &cb) {
-
-  // we don't want to remember to free whatever we strdup - so have unique_ptr
-  // do this for us
-  std::unique_ptr<char, decltype(std::free) *> input{strdup(line.c_str()),
-                                                     std::free};
-
-  if (!input) {
-    throw ParseError(line);
+Result Processor<BookT>::process(const Message &message, FillsCallback &cb) {
+  switch (message.action) {
+  case Action::Add:
+    return process<Action::Add, FillsCallback>(message.symbol, message.oid,
+                                               message.dir, message.volume,
+                                               message.price, cb);
+  case Action::Modify:
+    return process<Action::Modify, FillsCallback>(
+        message.symbol, message.oid, message.dir, message.volume,
+        message.price, cb);
+  case Action::Remove:
+    return process<Action::Remove, FillsCallback>(
+        message.symbol, message.oid, message.dir, 0, message.price, cb);
+  case Action::Ioc:
+    return process<Action::Ioc, FillsCallback>(message.symbol, message.oid,
+                                               message.dir, message.volume,
+                                               message.price, cb);
+  case Action::Fok:
+    return process<Action::Fok, FillsCallback>(message.symbol, message.oid,
+                                               message.dir, message.volume,
+                                               message.price, cb);
+  case Action::Market:
+    return process<Action::Market, FillsCallback>(
+        message.symbol, message.oid, message.dir, message.volume, 0, cb);
+  default:
+    return Result::BadMessage;
   }
+}
 
-  try {
-    const Action action = details::tokenize<Action>(input.get());
-    switch (action) {
-    case Action::Add:
-    case Action::Modify: {
-      const uint32_t oid = details::tokenize<uint32_t>();
-      const Direction dir = details::tokenize<Direction>();
-      const uint32_t volume = details::tokenize<uint32_t>();
-      const uint32_t price = details::tokenize<uint32_t>();
-
-      if (Action::Add == action) {
-        process<Action::Add, FillsCallback>(oid, dir, volume, price, cb);
-      } else if (Action::Modify == action) {
-        process<Action::Modify, FillsCallback>(oid, dir, volume, price, cb);
+template <typename BookT>
+template <typename FillsCallback>
+std::size_t Processor<BookT>::process(const Message *messages,
+                                      std::size_t count, Result *results,
+                                      FillsCallback &cb,
+                                      std::size_t lookahead) {
+  std::size_t ok(0);
+  const std::size_t halfway(lookahead / 2);
+  for (std::size_t i = 0; i < count; ++i) {
+    if (0u != lookahead) {
+      if (i + lookahead < count) {
+        prefetch(messages[i + lookahead]);
       }
-    } break;
-
-    case Action::Remove: {
-      const uint32_t oid = details::tokenize<uint32_t>();
-      const Direction dir = details::tokenize<Direction>();
-      const uint32_t price = details::tokenize<uint32_t>();
+      if (i + halfway < count) {
+        prefetchOrder(messages[i + halfway]);
+      }
+    }
+    const Result result(process(messages[i], cb));
+    if (nullptr != results) {
+      results[i] = result;
+    }
+    if (likely(Result::Ok == result)) {
+      ++ok;
+    }
+  }
+  return ok;
+}
 
-      process<Action::Remove, FillsCallback>(oid, dir, 0, price, cb);
-    } break;
+template <typename BookT>
+void Processor<BookT>::prefetch(const Message &message) const {
+  const auto *book(details::peek(m_book, message.symbol));
+  if (unlikely(nullptr == book)) {
+    return;
+  }
+  switch (message.action) {
+  case Action::Add:
+  case Action::Modify:
+  case Action::Remove:
+    book->prefetch(message.dir, message.oid, message.price);
+    break;
+  default:
+    // orders that never rest only check their oid isn't resting, and take
+    // from the front of the other side, which is in cache already
+    book->getIndex().prefetch(message.oid);
+    break;
+  }
+}
 
-    default:
-      throw ParseError(line);
-    };
-  } catch (ParseError e) {
-    throw ParseError(0 == strlen(e.what()) ? line : e.what());
+template <typename BookT>
+void Processor<BookT>::prefetchOrder(const Message &message) const {
+  if (Action::Modify != message.action && Action::Remove != message.action) {
+    return;
+  }
+  const auto *book(details::peek(m_book, message.symbol));
+  if (likely(nullptr != book)) {
+    book->prefetchOrder(message.oid);
   }
 }
 
+template <typename BookT>
+constexpr std::size_t Processor<BookT>::defaultLookahead;
+
 } // namespace orderbook
 } // namespace mvs
 
@@ -0,0 +1,83 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "Common.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a value one thread writes and any number of others read, without the
+// writer ever waiting for a reader. The sequence number is odd while a write
+// is going on; a reader that sees it change, or odd, while it was copying the
+// value just copies it again.
+//
+// The value is kept as atomic words, copied in and out with relaxed loads and
+// stores, so a reader racing with the writer gets a torn copy it throws away
+// rather than undefined behaviour.
+template <typename T> struct Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "the value gets copied around as words");
+
+  // all zeroes to start with
+  Seqlock() {
+    for (auto &word : m_words) {
+      word.store(0, std::memory_order_relaxed);
+    }
+  }
+  Seqlock(Seqlock &) = delete;
+  Seqlock &operator=(Seqlock &) = delete;
+
+  // writer only
+  void store(const T &value) {
+    uint64_t words[wordCount] = {};
+    memcpy(words, &value, sizeof(T));
+    const uint64_t sequence(m_sequence.load(std::memory_order_relaxed));
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < wordCount; ++i) {
+      m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+    m_sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  // any thread. Only ever retries while the writer is in the middle of a
+  // store.
+  T load() const {
+    uint64_t words[wordCount];
+    uint64_t before, after;
+    do {
+      before = m_sequence.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < wordCount; ++i) {
+        words[i] = m_words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = m_sequence.load(std::memory_order_relaxed);
+    } while (unlikely(0u != (before & 1u) || before != after));
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+  // the number of stores so far
+  uint64_t version() const {
+    return m_sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static constexpr std::size_t wordCount =
+      (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  std::atomic<uint64_t> m_sequence{0};
+  std::atomic<uint64_t> m_words[wordCount];
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // SEQLOCK_H
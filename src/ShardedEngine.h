@@ -0,0 +1,185 @@
+#ifndef SHARDEDENGINE_H
+#define SHARDEDENGINE_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "BookManager.h"
+#include "Common.h"
+#include "Exceptions.h"
+#include "OrderBook.h"
+#include "Parser.h"
+#include "Processor.h"
+#include "SpscRing.h"
+
+namespace mvs {
+namespace orderbook {
+
+// what a shard went through, and what went wrong, in the same terms main
+// counts them in
+struct ShardStats {
+  uint64_t messages = 0;
+  uint64_t trades = 0;
+  uint64_t duplicateOrderIdErrors = 0;
+  uint64_t unknownOrderIdErrors = 0;
+  uint64_t parseErrors = 0;
+
+  ShardStats &operator+=(const ShardStats &other) {
+    messages += other.messages;
+    trades += other.trades;
+    duplicateOrderIdErrors += other.duplicateOrderIdErrors;
+    unknownOrderIdErrors += other.unknownOrderIdErrors;
+    parseErrors += other.parseErrors;
+    return *this;
+  }
+};
+
+// symbols split over a number of worker threads, each with the books for its
+// own symbols. Whoever submits messages ( one thread, typically the one
+// parsing ) hands them to the right worker through a ring of its own, so a
+// symbol's messages get to its book in the order they were submitted, and no
+// book is ever touched by more than one thread.
+//
+// Every worker gets its own copy of the callback, or a callback of its own,
+// and calls it on its own thread.
+template <typename BookT = OrderBook, typename FillsCallback = void (*)(
+                                          const Trade &)>
+struct ShardedEngine {
+  // workers are pinned to cores one after the other, starting at firstCore,
+  // if there are that many. Each book gets room for orders and levels.
+  ShardedEngine(std::size_t shards, FillsCallback cb,
+                std::size_t ringCapacity = 4096, std::size_t orders = 1024,
+                std::size_t levels = 256, unsigned firstCore = 1)
+      : ShardedEngine(std::vector<FillsCallback>(shards, cb), ringCapacity,
+                      orders, levels, firstCore) {}
+
+  // a shard for each callback, e.g. each with a TradeSink of its own
+  explicit ShardedEngine(const std::vector<FillsCallback> &callbacks,
+                         std::size_t ringCapacity = 4096,
+                         std::size_t orders = 1024, std::size_t levels = 256,
+                         unsigned firstCore = 1) {
+    for (const FillsCallback &cb : callbacks) {
+      m_shards.emplace_back(new Shard(cb, ringCapacity, orders, levels));
+    }
+    for (std::size_t i = 0; i < m_shards.size(); ++i) {
+      Shard &shard(*m_shards[i]);
+      shard.thread = std::thread([this, &shard] { run(shard); });
+      pin(shard.thread, firstCore + i);
+    }
+  }
+  ShardedEngine(ShardedEngine &) = delete;
+  ShardedEngine &operator=(ShardedEngine &) = delete;
+
+  ~ShardedEngine() { stop(); }
+
+  // waits for room if the worker's ring is full. Only ever from one thread.
+  void submit(const Message &message) {
+    auto &ring(m_shards[message.symbol % m_shards.size()]->ring);
+    while (unlikely(!ring.push(message))) {
+      std::this_thread::yield();
+    }
+  }
+
+  // lets the workers finish what's been submitted, then waits for them
+  void stop() {
+    m_running.store(false, std::memory_order_release);
+    for (auto &shard : m_shards) {
+      if (shard->thread.joinable()) {
+        shard->thread.join();
+      }
+    }
+  }
+
+  std::size_t size() const { return m_shards.size(); }
+
+  // only once stopped. The books for the symbols of shard i are in
+  // books(i), under their own symbol id.
+  const BookManager<BookT> &books(std::size_t shard) const {
+    return m_shards[shard]->books;
+  }
+  ShardStats stats() const {
+    ShardStats stats;
+    for (const auto &shard : m_shards) {
+      stats += shard->stats;
+    }
+    return stats;
+  }
+
+private:
+  struct Shard {
+    Shard(FillsCallback cb, std::size_t ringCapacity, std::size_t orders,
+          std::size_t levels)
+        : cb(cb), ring(ringCapacity), books(0, orders, levels),
+          processor(books) {}
+
+    FillsCallback cb;
+    SpscRing<Message> ring;
+    BookManager<BookT> books;
+    Processor<BookManager<BookT>> processor;
+    ShardStats stats;
+    std::thread thread;
+  };
+
+  void run(Shard &shard) {
+    Message message;
+    while (true) {
+      if (likely(shard.ring.pop(message))) {
+        process(shard, message);
+      } else if (m_running.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      } else if (!shard.ring.pop(message)) {
+        // everything submitted before stop() is in the ring by now
+        break;
+      } else {
+        process(shard, message);
+      }
+    }
+  }
+
+  void process(Shard &shard, const Message &message) {
+    ++shard.stats.messages;
+    auto fills = [&shard](const Trade &trade) {
+      ++shard.stats.trades;
+      shard.cb(trade);
+    };
+    switch (shard.processor.process(message, fills)) {
+    case Result::Ok:
+      break;
+    case Result::DuplicateOrderId:
+      ++shard.stats.duplicateOrderIdErrors;
+      break;
+    case Result::UnknownOrderId:
+      ++shard.stats.unknownOrderIdErrors;
+      break;
+    default:
+      ++shard.stats.parseErrors;
+      break;
+    }
+  }
+
+  // best effort - on a machine with fewer cores the thread just floats
+  static void pin(std::thread &thread, std::size_t core) {
+    if (core >= std::thread::hardware_concurrency()) {
+      return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+  }
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  std::atomic<bool> m_running{true};
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // SHARDEDENGINE_H
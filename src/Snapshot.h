@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cinttypes>
+#include <cstddef>
+
+#include "Actions.h"
+#include "Enums.h"
+#include "Level.h"
+#include "Seqlock.h"
+
+namespace mvs {
+namespace orderbook {
+
+// the best depth levels on each side, best first. The first of each is the
+// top of the book.
+template <std::size_t depth> struct BookSnapshot {
+  // the number of updates the book had seen
+  uint64_t updates;
+  // how many levels of bids and asks are filled in, up to depth
+  uint32_t bidLevels;
+  uint32_t askLevels;
+  LevelSummary bids[depth];
+  LevelSummary asks[depth];
+};
+
+template <std::size_t depth, typename BookT>
+void takeSnapshot(const BookT &book, uint64_t updates,
+                  BookSnapshot<depth> &snapshot) {
+  snapshot.updates = updates;
+  snapshot.bidLevels = book.getBuySide().depth(snapshot.bids, depth);
+  snapshot.askLevels = book.getSellSide().depth(snapshot.asks, depth);
+}
+
+// a book that publishes a snapshot of its best levels after every update
+// that changed it. Any number of threads can read the latest one while the
+// book goes on matching on its own thread, and never hold it up.
+template <typename BookT, std::size_t depth = 5>
+struct PublishedBook : public BookT {
+  using SnapshotT = BookSnapshot<depth>;
+
+  using BookT::BookT;
+
+  template <Action action, Direction dir, typename FillsCallback>
+  Result handle(const OrderAction<action, dir> &oaction, FillsCallback &cb) {
+    const Result result(BookT::handle(oaction, cb));
+    // a message the book turns down doesn't change anything
+    if (likely(Result::Ok == result)) {
+      takeSnapshot(*this, ++m_updates, m_scratch);
+      m_published.store(m_scratch);
+    }
+    return result;
+  }
+
+  // the latest snapshot, from any thread
+  SnapshotT snapshot() const { return m_published.load(); }
+  const Seqlock<SnapshotT> &published() const { return m_published; }
+
+private:
+  uint64_t m_updates = 0;
+  SnapshotT m_scratch;
+  Seqlock<SnapshotT> m_published;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // SNAPSHOT_H
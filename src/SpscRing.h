@@ -0,0 +1,90 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <assert.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+#include "Common.h"
+
+namespace mvs {
+namespace orderbook {
+
+// a fixed size queue between exactly one thread pushing and one thread
+// popping, without locks. Each side only ever writes its own index; it keeps
+// a copy of the other side's index and only reads the real one ( which means
+// pulling over a cache line the other thread writes to ) once the copy says
+// the ring is full, or empty.
+template <typename T> struct SpscRing {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "elements are copied in and out as they are");
+
+  // the capacity gets rounded up to a power of two
+  explicit SpscRing(std::size_t capacity) {
+    std::size_t slots(2);
+    while (slots < capacity) {
+      slots *= 2;
+    }
+    m_slots.reset(new T[slots]);
+    m_mask = slots - 1;
+  }
+  SpscRing(SpscRing &) = delete;
+  SpscRing &operator=(SpscRing &) = delete;
+
+  // producer only. False if the ring is full.
+  bool push(const T &value) {
+    const std::size_t tail(m_tail.load(std::memory_order_relaxed));
+    if (unlikely(tail - m_cachedHead > m_mask)) {
+      m_cachedHead = m_head.load(std::memory_order_acquire);
+      if (tail - m_cachedHead > m_mask) {
+        return false;
+      }
+    }
+    m_slots[tail & m_mask] = value;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only. False if the ring is empty.
+  bool pop(T &value) {
+    const std::size_t head(m_head.load(std::memory_order_relaxed));
+    if (unlikely(head == m_cachedTail)) {
+      m_cachedTail = m_tail.load(std::memory_order_acquire);
+      if (head == m_cachedTail) {
+        return false;
+      }
+    }
+    value = m_slots[head & m_mask];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t capacity() const { return m_mask + 1; }
+
+private:
+  // cache lines are 64 bytes, the padding keeps what each side writes on
+  // lines of its own
+  static constexpr std::size_t cacheLine = 64;
+
+  std::unique_ptr<T[]> m_slots;
+  std::size_t m_mask;
+  char m_padShared[cacheLine];
+
+  // the producer's
+  std::atomic<std::size_t> m_tail{0};
+  std::size_t m_cachedHead = 0;
+  char m_padProducer[cacheLine];
+
+  // the consumer's
+  std::atomic<std::size_t> m_head{0};
+  std::size_t m_cachedTail = 0;
+  char m_padConsumer[cacheLine];
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // SPSCRING_H
@@ -0,0 +1,273 @@
+#ifndef TRADESINK_H
+#define TRADESINK_H
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Actions.h"
+#include "Common.h"
+
+namespace mvs {
+namespace orderbook {
+
+namespace details {
+
+// the digits of value, at out. Returns how many there are.
+inline std::size_t formatDecimal(uint32_t value, char *out) {
+  char digits[10];
+  std::size_t count(0);
+  do {
+    digits[count++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (0u != value);
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = digits[count - 1 - i];
+  }
+  return count;
+}
+
+inline std::size_t formatText(const char *text, std::size_t length,
+                              char *out) {
+  memcpy(out, text, length);
+  return length;
+}
+
+} // namespace details
+
+// a trade as a line of text, same as printing it with "Trade " in front
+struct TextEncoding {
+  static constexpr std::size_t maxSize = 128;
+
+  static std::size_t encode(const Trade &trade, char *out) {
+    char *pos(out);
+    pos += details::formatText("Trade T buy_oid:", 16, pos);
+    pos += details::formatDecimal(trade.getBuyOid(), pos);
+    pos += details::formatText(" vs sell_oid:", 13, pos);
+    pos += details::formatDecimal(trade.getSellOid(), pos);
+    pos += details::formatText(" price:", 7, pos);
+    pos += details::formatDecimal(trade.getPrice(), pos);
+    pos += details::formatText(" volume:", 8, pos);
+    pos += details::formatDecimal(trade.getVolume(), pos);
+    *pos++ = '\n';
+    return pos - out;
+  }
+};
+
+// a trade as 16 bytes, little endian: buy oid, sell oid, volume, price
+struct BinaryEncoding {
+  static constexpr std::size_t maxSize = 16;
+
+  static std::size_t encode(const Trade &trade, char *out) {
+    const uint32_t fields[4] = {trade.getBuyOid(), trade.getSellOid(),
+                                trade.getVolume(), trade.getPrice()};
+    memcpy(out, fields, sizeof(fields));
+    return sizeof(fields);
+  }
+};
+
+// writes whole batches to a file descriptor, on the thread that hands them
+// over. A write that fails doesn't throw, whoever's matching can't do
+// anything about it - the errno is kept, and nothing gets written after that.
+struct FdWriter {
+  explicit FdWriter(int fd, std::size_t bufferSize = 1 << 16)
+      : m_fd(fd), m_buffer(new char[bufferSize]), m_size(bufferSize) {}
+  FdWriter(FdWriter &) = delete;
+  FdWriter &operator=(FdWriter &) = delete;
+
+  // where the next batch goes, there's room for capacity() bytes
+  char *acquire() { return m_buffer.get(); }
+  std::size_t capacity() const { return m_size; }
+
+  // the batch in the buffer from acquire() is done
+  void release(std::size_t used) {
+    if (likely(0 == m_error)) {
+      m_error = tryWriteAll(m_fd, m_buffer.get(), used);
+    }
+  }
+
+  // the errno of the write that failed, if one did
+  int error() const { return m_error; }
+
+  // 0, or the errno of the write that failed
+  static int tryWriteAll(int fd, const char *data, std::size_t size) {
+    while (0u != size) {
+      const ssize_t written(::write(fd, data, size));
+      if (written < 0) {
+        if (EINTR == errno) {
+          continue;
+        }
+        return errno;
+      }
+      data += written;
+      size -= written;
+    }
+    return 0;
+  }
+
+  static void writeAll(int fd, const char *data, std::size_t size) {
+    const int error(tryWriteAll(fd, data, size));
+    if (0 != error) {
+      throw std::system_error(error, std::generic_category(), "write");
+    }
+  }
+
+private:
+  const int m_fd;
+  std::unique_ptr<char[]> m_buffer;
+  const std::size_t m_size;
+  int m_error = 0;
+};
+
+// the same, only the writing happens on a thread of its own. Batches are
+// handed over whole, so the two threads only meet once per batch, and the
+// one filling them only waits if all the buffers are still being written.
+// Once a write fails, the batches after it are dropped, see error().
+struct ThreadedWriter {
+  explicit ThreadedWriter(int fd, std::size_t bufferSize = 1 << 16,
+                          std::size_t buffers = 4)
+      : m_fd(fd), m_size(bufferSize) {
+    for (std::size_t i = 0; i < buffers; ++i) {
+      m_buffers.emplace_back(new char[bufferSize]);
+      m_free.push_back(m_buffers.back().get());
+    }
+    m_thread = std::thread([this] { run(); });
+  }
+  ThreadedWriter(ThreadedWriter &) = delete;
+  ThreadedWriter &operator=(ThreadedWriter &) = delete;
+
+  ~ThreadedWriter() { stop(); }
+
+  // writes whatever's been released, then waits for the writing thread to
+  // finish
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wakeWriter.notify_one();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  // the errno of the write that failed, if one did - from any thread, but
+  // only final once it's stopped
+  int error() const { return m_error.load(std::memory_order_acquire); }
+
+  char *acquire() {
+    if (nullptr == m_current) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wakeFiller.wait(lock, [this] { return !m_free.empty(); });
+      m_current = m_free.front();
+      m_free.pop_front();
+    }
+    return m_current;
+  }
+  std::size_t capacity() const { return m_size; }
+
+  void release(std::size_t used) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_full.emplace_back(m_current, used);
+    }
+    m_current = nullptr;
+    m_wakeWriter.notify_one();
+  }
+
+private:
+  void run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_wakeWriter.wait(lock,
+                        [this] { return m_stopping || !m_full.empty(); });
+      if (m_full.empty()) {
+        return;
+      }
+      const std::pair<char *, std::size_t> batch(m_full.front());
+      m_full.pop_front();
+      lock.unlock();
+      if (0 == m_error.load(std::memory_order_relaxed)) {
+        const int error(
+            FdWriter::tryWriteAll(m_fd, batch.first, batch.second));
+        if (0 != error) {
+          m_error.store(error, std::memory_order_release);
+        }
+      }
+      lock.lock();
+      m_free.push_back(batch.first);
+      m_wakeFiller.notify_one();
+    }
+  }
+
+  const int m_fd;
+  const std::size_t m_size;
+  std::vector<std::unique_ptr<char[]>> m_buffers;
+  // the buffer being filled, if any - only the filling thread touches it
+  char *m_current = nullptr;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wakeWriter;
+  std::condition_variable m_wakeFiller;
+  std::deque<char *> m_free;
+  std::deque<std::pair<char *, std::size_t>> m_full;
+  bool m_stopping = false;
+  std::atomic<int> m_error{0};
+  std::thread m_thread;
+};
+
+// a fills callback that encodes trades into a batch, and hands it to the
+// writer once there's no room for another one. Unbatched, every trade gets
+// written straight away.
+template <typename Encoding, typename Writer> struct TradeSink {
+  // the writer's buffers have to fit a trade
+  explicit TradeSink(Writer &writer, bool batched = true)
+      : m_writer(writer), m_batched(batched) {
+    assert(m_writer.capacity() >= Encoding::maxSize);
+    m_begin = m_pos = m_writer.acquire();
+    m_end = m_begin + m_writer.capacity();
+  }
+  TradeSink(TradeSink &) = delete;
+  TradeSink &operator=(TradeSink &) = delete;
+
+  ~TradeSink() { m_writer.release(m_pos - m_begin); }
+
+  void operator()(const Trade &trade) {
+    m_pos += Encoding::encode(trade, m_pos);
+    const std::size_t left(m_end - m_pos);
+    if (unlikely(!m_batched || left < Encoding::maxSize)) {
+      flush();
+    }
+  }
+
+  void flush() {
+    m_writer.release(m_pos - m_begin);
+    m_begin = m_pos = m_writer.acquire();
+    m_end = m_begin + m_writer.capacity();
+  }
+
+private:
+  Writer &m_writer;
+  const bool m_batched;
+  char *m_begin;
+  char *m_pos;
+  char *m_end;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // TRADESINK_H
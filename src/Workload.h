@@ -0,0 +1,356 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "Actions.h"
+#include "BookManager.h"
+#include "Enums.h"
+#include "OrderBook.h"
+#include "Parser.h"
+#include "Processor.h"
+
+namespace mvs {
+namespace orderbook {
+
+// what the flow of messages looks like. The rates are per message, the
+// ratios are out of the messages that aren't part of a burst.
+struct WorkloadOptions {
+  // symbols are picked with a Zipf distribution, the first one the most,
+  // skewed this much ( 0 is all the same )
+  uint32_t symbols = 1;
+  double skew = 1.0;
+
+  // every symbol's mid starts here, and takes a tick up or down this often
+  uint32_t startPrice = 10000;
+  double walk = 0.1;
+  // how far from the mid passive orders go, in ticks: 1 + geometric with
+  // this chance of stopping at each tick - the higher, the closer they stay
+  double depth = 0.2;
+  uint32_t maxVolume = 10;
+
+  // of the messages that aren't part of a burst, and what's left goes to adds
+  double cancels = 0.35;
+  double modifies = 0.15;
+  // the share of adds that cross the spread, and of those the share that
+  // are sent as IOC, FOK or market orders ( one as likely as another )
+  // instead
+  double aggressive = 0.02;
+  double immediates = 0.0;
+  // how often a burst of orders crossing the spread from one side starts, and
+  // how many orders it has
+  double bursts = 0.0005;
+  uint32_t burst = 20;
+
+  // cancels and modifies go for one of two resting orders picked at random:
+  // with this chance the one further from the top of the book - behind more
+  // of the queue - otherwise either
+  double backBias = 0.8;
+  // the number of orders a symbol's book levels off at, adds turn into
+  // cancels beyond it
+  uint32_t resting = 5000;
+
+  uint64_t seed = 42;
+};
+
+// a synthetic flow shaped like a real one: passive orders around a mid that
+// takes a random walk, cancels and modifies going for orders that are
+// actually resting - more often the ones at the back - the odd order and
+// burst of orders crossing the spread, and symbols that aren't all as busy.
+//
+// It keeps a book per symbol and puts every message through it, to know
+// what's resting, so the messages come out at the speed of the book rather
+// than of a file.
+struct Workload {
+  explicit Workload(const WorkloadOptions &options = WorkloadOptions())
+      : m_options(options), m_rng(options.seed),
+        m_books(options.symbols, options.resting * 2, 256),
+        m_processor(m_books), m_offset(options.depth),
+        m_volume(1, options.maxVolume), m_symbols(symbolWeights(options)) {
+    m_states.resize(options.symbols);
+    for (SymbolState &state : m_states) {
+      state.mid = options.startPrice;
+    }
+  }
+  Workload(Workload &) = delete;
+  Workload &operator=(Workload &) = delete;
+
+  Message next() {
+    const uint16_t symbol(
+        static_cast<uint16_t>(m_options.symbols > 1 ? m_symbols(m_rng) : 0));
+    SymbolState &state(m_states[symbol]);
+    ArrayOrderBook &book(m_books[symbol]);
+    walk(state);
+
+    Message message;
+    if (0u != state.burstLeft || chance(m_options.bursts)) {
+      if (0u == state.burstLeft) {
+        state.burstSide = chance(0.5) ? Direction::Buy : Direction::Sell;
+        state.burstLeft = m_options.burst;
+      }
+      --state.burstLeft;
+      message = add(state, book, state.burstSide, true);
+    } else {
+      const double pick(m_uniform(m_rng));
+      if (state.live.size() >= m_options.resting ||
+          pick < m_options.cancels) {
+        message = cancel(state, book);
+      } else if (pick < m_options.cancels + m_options.modifies) {
+        message = modify(state, book);
+      } else {
+        message = add(state, book,
+                      chance(0.5) ? Direction::Buy : Direction::Sell,
+                      chance(m_options.aggressive));
+      }
+    }
+    message.symbol = symbol;
+    // can't be turned down, we only go for orders that are resting
+    m_processor.process(message, m_fills);
+    return message;
+  }
+
+  const BookManager<ArrayOrderBook> &books() const { return m_books; }
+
+private:
+  struct SymbolState {
+    uint32_t mid;
+    // oids that were resting when last seen - some of them will have traded
+    // since, they're weeded out as they're picked
+    std::vector<uint32_t> live;
+    Direction burstSide = Direction::Buy;
+    uint32_t burstLeft = 0;
+  };
+
+  static std::discrete_distribution<uint32_t>
+  symbolWeights(const WorkloadOptions &options) {
+    std::vector<double> weights;
+    for (uint32_t symbol = 0; symbol < options.symbols; ++symbol) {
+      weights.push_back(1.0 / std::pow(symbol + 1.0, options.skew));
+    }
+    return std::discrete_distribution<uint32_t>(weights.begin(),
+                                                weights.end());
+  }
+
+  bool chance(double p) { return m_uniform(m_rng) < p; }
+
+  void walk(SymbolState &state) {
+    if (chance(m_options.walk)) {
+      state.mid = chance(0.5) ? state.mid + 1 : std::max(state.mid - 1, 1000u);
+    }
+  }
+
+  // a price on our side of the mid, that doesn't cross what's resting on the
+  // other side
+  uint32_t passivePrice(const SymbolState &state, const ArrayOrderBook &book,
+                        Direction dir) {
+    const uint32_t offset(1 + m_offset(m_rng));
+    if (Direction::Buy == dir) {
+      uint32_t price(state.mid > offset ? state.mid - offset : 1);
+      if (!book.getSellSide().empty()) {
+        price = std::min(price, book.getSellSide().front().first - 1);
+      }
+      return price;
+    }
+    uint32_t price(state.mid + offset);
+    if (!book.getBuySide().empty()) {
+      price = std::max(price, book.getBuySide().front().first + 1);
+    }
+    return price;
+  }
+
+  // a few ticks through the best price on the other side, if there is one
+  uint32_t aggressivePrice(const SymbolState &state, const ArrayOrderBook &book,
+                           Direction dir) {
+    const uint32_t through(m_rng() % 3);
+    if (Direction::Buy == dir) {
+      return book.getSellSide().empty()
+                 ? passivePrice(state, book, dir)
+                 : book.getSellSide().front().first + through;
+    }
+    return book.getBuySide().empty()
+               ? passivePrice(state, book, dir)
+               : std::max(book.getBuySide().front().first, through + 1) -
+                     through;
+  }
+
+  Message add(SymbolState &state, const ArrayOrderBook &book, Direction dir,
+              bool aggressive) {
+    Message message;
+    message.action = Action::Add;
+    message.dir = dir;
+    message.oid = m_nextOid++;
+    message.volume = m_volume(m_rng);
+    message.price = aggressive ? aggressivePrice(state, book, dir)
+                               : passivePrice(state, book, dir);
+    if (aggressive && 0.0 != m_options.immediates &&
+        chance(m_options.immediates)) {
+      // they never rest, so there's nothing to cancel later
+      static const Action immediates[] = {Action::Ioc, Action::Fok,
+                                          Action::Market};
+      message.action = immediates[m_rng() % 3];
+      if (Action::Market == message.action) {
+        message.price = 0;
+      }
+      return message;
+    }
+    state.live.push_back(message.oid);
+    return message;
+  }
+
+  // where a resting order is in the live list - unless nothing's resting any
+  // more, and the list is empty
+  std::size_t pickOne(SymbolState &state, const ArrayOrderBook &book) {
+    while (!state.live.empty()) {
+      const std::size_t pos(m_rng() % state.live.size());
+      if (nullptr != book.getIndex().find(state.live[pos])) {
+        return pos;
+      }
+      state.live[pos] = state.live.back();
+      state.live.pop_back();
+    }
+    return 0;
+  }
+
+  // how far behind the front of its side the order is: the levels in front
+  // of it, then the orders added before it at the same price
+  static std::pair<uint32_t, uint32_t> behind(const ArrayOrderBook &book,
+                                              uint32_t oid) {
+    const OrderLocation &location(*book.getIndex().find(oid));
+    const uint32_t levels(
+        Direction::Buy == location.dir
+            ? book.getBuySide().front().first - location.price
+            : location.price - book.getSellSide().front().first);
+    return std::make_pair(levels, oid);
+  }
+
+  // one resting order, more likely one of those further back. Returns its
+  // place in the live list, same as pickOne.
+  std::size_t pickResting(SymbolState &state, const ArrayOrderBook &book) {
+    const std::size_t first(pickOne(state, book));
+    if (state.live.empty()) {
+      return 0;
+    }
+    const std::size_t second(pickOne(state, book));
+    // picking the second one can have weeded out the first
+    if (first >= state.live.size() ||
+        nullptr == book.getIndex().find(state.live[first])) {
+      return second;
+    }
+    if (!chance(m_options.backBias)) {
+      return first;
+    }
+    return behind(book, state.live[first]) >= behind(book, state.live[second])
+               ? first
+               : second;
+  }
+
+  Message cancel(SymbolState &state, const ArrayOrderBook &book) {
+    const std::size_t pos(pickResting(state, book));
+    if (state.live.empty()) {
+      return add(state, book, chance(0.5) ? Direction::Buy : Direction::Sell,
+                 false);
+    }
+    const uint32_t oid(state.live[pos]);
+    const OrderLocation &location(*book.getIndex().find(oid));
+    Message message;
+    message.action = Action::Remove;
+    message.dir = location.dir;
+    message.oid = oid;
+    message.volume = 0;
+    message.price = location.price;
+    state.live[pos] = state.live.back();
+    state.live.pop_back();
+    return message;
+  }
+
+  // half the time less volume at the same price, otherwise somewhere else on
+  // the same side
+  Message modify(SymbolState &state, const ArrayOrderBook &book) {
+    const std::size_t pos(pickResting(state, book));
+    if (state.live.empty()) {
+      return add(state, book, chance(0.5) ? Direction::Buy : Direction::Sell,
+                 false);
+    }
+    const OrderLocation &location(*book.getIndex().find(state.live[pos]));
+    const uint32_t volume(location.order->getVolume());
+    Message message;
+    message.action = Action::Modify;
+    message.dir = location.dir;
+    message.oid = state.live[pos];
+    if (volume > 1 && chance(0.5)) {
+      message.volume = volume - 1 - m_rng() % (volume - 1);
+      message.price = location.price;
+    } else {
+      message.volume = m_volume(m_rng);
+      message.price = passivePrice(state, book, location.dir);
+    }
+    return message;
+  }
+
+  const WorkloadOptions m_options;
+  std::mt19937_64 m_rng;
+  BookManager<ArrayOrderBook> m_books;
+  Processor<BookManager<ArrayOrderBook>> m_processor;
+  std::vector<SymbolState> m_states;
+  uint32_t m_nextOid = 0;
+
+  std::uniform_real_distribution<double> m_uniform;
+  std::geometric_distribution<uint32_t> m_offset;
+  std::uniform_int_distribution<uint32_t> m_volume;
+  std::discrete_distribution<uint32_t> m_symbols;
+  void (*m_fills)(const Trade &) = [](const Trade &) {};
+};
+
+// what gen.R used to write: pairs of orders added far apart, then modified
+// to prices that overlap. Oids go up by two for every pair.
+struct GenRWorkload {
+  explicit GenRWorkload(uint64_t seed = 42) : m_rng(seed) {}
+
+  Message next() {
+    Message message;
+    switch (m_step++ % 4) {
+    case 0:
+      m_bidVolume = sample(1, 8);
+      m_askVolume = sample(1, 8);
+      message = Message{Action::Add, Direction::Buy, m_oid, m_bidVolume,
+                        sample(10, 100), 0};
+      break;
+    case 1:
+      message = Message{Action::Add, Direction::Sell, m_oid + 1, m_askVolume,
+                        sample(600, 2000), 0};
+      break;
+    case 2:
+      message = Message{Action::Modify, Direction::Buy, m_oid, m_bidVolume,
+                        sample(100, 500), 0};
+      break;
+    default:
+      message = Message{Action::Modify, Direction::Sell, m_oid + 1,
+                        m_askVolume, sample(100, 480), 0};
+      m_oid += 2;
+      break;
+    }
+    return message;
+  }
+
+private:
+  uint32_t sample(uint32_t from, uint32_t to) {
+    return std::uniform_int_distribution<uint32_t>(from, to)(m_rng);
+  }
+
+  std::mt19937_64 m_rng;
+  uint64_t m_step = 0;
+  uint32_t m_oid = 0;
+  uint32_t m_bidVolume = 0;
+  uint32_t m_askVolume = 0;
+};
+
+} // namespace orderbook
+} // namespace mvs
+
+#endif // WORKLOAD_H
@@ -0,0 +1,840 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Actions.h"
+#include "../BookManager.h"
+#include "../BookState.h"
+#include "../Journal.h"
+#include "../Latency.h"
+#include "../OrderBook.h"
+#include "../Parser.h"
+#include "../Processor.h"
+#include "../ShardedEngine.h"
+#include "../Snapshot.h"
+#include "../TradeSink.h"
+#include "../Workload.h"
+
+using namespace mvs::orderbook;
+
+namespace {
+
+auto dummyCallback = [](const Trade &) {};
+
+// resting buy orders only, spread over a range of prices so nothing crosses.
+// oids are 0 .. depth-1, and there are about depth / levels orders per level.
+void fillBook(OrderBook &book, uint32_t depth, uint32_t levels) {
+  for (uint32_t oid = 0; oid < depth; ++oid) {
+    OrderAction<Action::Add, Direction::Buy> action(oid, 1 + oid % 8,
+                                                    1000 + oid % levels);
+    book.handle(action, dummyCallback);
+  }
+}
+
+// orders added and cancelled around a slowly moving mid, with the odd one
+// crossing the spread. About 4000 orders rest in the book.
+std::vector<Message> touchMessages(uint32_t count) {
+  std::mt19937 rng(42);
+  std::vector<Message> messages;
+  std::vector<Message> resting;
+  uint32_t mid(100000);
+  for (uint32_t oid = 0; messages.size() < count; ++oid) {
+    mid += int(rng() % 3) - 1;
+    if (resting.size() >= 4000 || (!resting.empty() && rng() % 2)) {
+      std::swap(resting[rng() % resting.size()], resting.back());
+      Message cancel(resting.back());
+      cancel.action = Action::Remove;
+      messages.push_back(cancel);
+      resting.pop_back();
+    }
+    const Direction dir(rng() % 2 ? Direction::Buy : Direction::Sell);
+    const int offset(int(rng() % 50) - 1);
+    const uint32_t price(Direction::Buy == dir ? mid - offset : mid + offset);
+    const uint32_t volume(1 + rng() % 10);
+    messages.push_back({Action::Add, dir, oid, volume, price, 0});
+    resting.push_back(messages.back());
+  }
+  return messages;
+}
+
+template <typename BookT>
+void replay(BookT &book, const std::vector<Message> &messages) {
+  Processor<BookT> processor(book);
+  for (const Message &message : messages) {
+    // cancels for orders that have traded already are turned down
+    processor.process(message, dummyCallback);
+  }
+}
+
+// the messages as they'd be in an input file, some with a comment
+std::vector<std::string> toLines(const std::vector<Message> &messages) {
+  std::vector<std::string> lines;
+  for (const Message &message : messages) {
+    std::string line;
+    line += static_cast<char>(message.action);
+    line += ',' + std::to_string(message.oid) + ',';
+    line += static_cast<char>(message.dir);
+    if (Action::Remove != message.action) {
+      line += ',' + std::to_string(message.volume);
+    }
+    line += ',' + std::to_string(message.price);
+    if (0u == message.oid % 16) {
+      line += " // comment";
+    }
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// what the Processor used to do: strtok through a null terminated copy of the
+// line, and a digit at a time
+namespace strtokParser {
+
+uint32_t number() {
+  const char *input(strtok(nullptr, ",/"));
+  if (nullptr == input) {
+    throw ParseError();
+  }
+  uint32_t output(0);
+  while (true) {
+    const char c = *(input++);
+    if (c == ' ' || c == '\r' || c == '\0') {
+      return output;
+    } else if (c < '0' || c > '9') {
+      throw ParseError("invalid number");
+    }
+    output = output * 10 + (c - '0');
+  }
+}
+
+char character(char *ptr = nullptr) {
+  const char *token(strtok(ptr, ",/"));
+  if (nullptr == token) {
+    throw ParseError();
+  }
+  return *token;
+}
+
+Message parseMessage(const char *line, std::size_t length) {
+  char buffer[256];
+  const std::size_t copied(std::min(length, sizeof(buffer) - 1));
+  memcpy(buffer, line, copied);
+  buffer[copied] = '\0';
+  Message message;
+  message.action = static_cast<Action>(character(buffer));
+  message.oid = number();
+  message.dir = static_cast<Direction>(character());
+  message.volume = Action::Remove == message.action ? 0 : number();
+  message.price = number();
+  return message;
+}
+
+} // namespace strtokParser
+
+// times every operation on its own, so the benchmarks using it report the
+// spread as well as the mean: p50, p90, p99, p99.9 and the worst, in ns, as
+// counters. Only the timed part counts towards the benchmark's own time
+// ( they use manual time ), so setting up the next operation doesn't.
+//
+// Reading the clock twice costs about as much as the cheapest operations -
+// BM_ClockOverhead is the floor the others sit on.
+struct SampledLatencies {
+  using Clock = std::chrono::steady_clock;
+
+  // only the last keep samples go into the percentiles, keep is a power of
+  // two
+  explicit SampledLatencies(benchmark::State &state, std::size_t keep = 1 << 20)
+      : m_state(state), m_samples(keep) {}
+  SampledLatencies(SampledLatencies &) = delete;
+  SampledLatencies &operator=(SampledLatencies &) = delete;
+
+  ~SampledLatencies() {
+    const std::size_t count(std::min(m_count, m_samples.size()));
+    if (0u == count) {
+      return;
+    }
+    std::sort(m_samples.begin(), m_samples.begin() + count);
+    auto percentile = [this, count](double p) {
+      return static_cast<double>(
+          m_samples[std::min(count - 1, static_cast<std::size_t>(p * count))]);
+    };
+    m_state.counters["p50"] = percentile(0.5);
+    m_state.counters["p90"] = percentile(0.9);
+    m_state.counters["p99"] = percentile(0.99);
+    m_state.counters["p99.9"] = percentile(0.999);
+    m_state.counters["max"] = static_cast<double>(m_samples[count - 1]);
+  }
+
+  template <typename F> void time(F &&f) {
+    const Clock::time_point start(Clock::now());
+    f();
+    const Clock::time_point end(Clock::now());
+    const std::chrono::nanoseconds elapsed(end - start);
+    m_samples[m_count++ & (m_samples.size() - 1)] = elapsed.count();
+    m_state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+  }
+
+private:
+  benchmark::State &m_state;
+  std::vector<uint64_t> m_samples;
+  std::size_t m_count = 0;
+};
+
+} // namespace
+
+// modify a random resting order to a random price on the same side. The book
+// keeps its size and the queue at each level stays short, so the time per
+// modify should not depend on how deep the book is.
+void BM_ModifyByBookDepth(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  const uint32_t levels(depth / 4);
+  OrderBook book;
+  fillBook(book, depth, levels);
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> oids(0, depth - 1);
+  std::uniform_int_distribution<uint32_t> prices(1000, 1000 + levels - 1);
+  for (auto _ : state) {
+    OrderAction<Action::Modify, Direction::Buy> action(oids(rng), 1,
+                                                       prices(rng));
+    book.handle(action, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModifyByBookDepth)->RangeMultiplier(4)->Range(1 << 10, 1 << 18);
+
+// remove a resting order and put it back again
+void BM_RemoveByBookDepth(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  const uint32_t levels(depth / 4);
+  OrderBook book;
+  fillBook(book, depth, levels);
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> oids(0, depth - 1);
+  for (auto _ : state) {
+    const uint32_t oid(oids(rng));
+    const uint32_t price(1000 + oid % levels);
+    OrderAction<Action::Remove, Direction::Buy> remove(oid, 0, price);
+    book.handle(remove, dummyCallback);
+    OrderAction<Action::Add, Direction::Buy> add(oid, 1, price);
+    book.handle(add, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RemoveByBookDepth)->RangeMultiplier(4)->Range(1 << 10, 1 << 18);
+
+// the two layouts of the oid index, by how many oids are in it: looking up
+// oids that are there ( hit:1 ) or aren't ( hit:0 ), which is what every
+// add does to check it's not a duplicate
+template <typename IndexT> void BM_IndexFind(benchmark::State &state) {
+  const uint32_t count(state.range(0));
+  IndexT index(count);
+  for (uint32_t oid = 0; oid < count; ++oid) {
+    index.insert(oid * 7, OrderLocation{Direction::Buy, oid, nullptr});
+  }
+  std::mt19937 rng(42);
+  std::vector<uint32_t> oids(1 << 16);
+  for (uint32_t &oid : oids) {
+    oid = 0 != state.range(1) ? rng() % count * 7 : rng() % count * 7 + 1;
+  }
+  std::size_t n(0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.find(oids[n++ & (oids.size() - 1)]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_IndexFind, SlotIndex)
+    ->ArgNames({"oids", "hit"})
+    ->ArgsProduct({{1 << 10, 1 << 16, 1 << 20, 1 << 23}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_IndexFind, GroupedIndex)
+    ->ArgNames({"oids", "hit"})
+    ->ArgsProduct({{1 << 10, 1 << 16, 1 << 20, 1 << 23}, {0, 1}});
+
+// an oid taken out and a new one put in, as orders come and go
+template <typename IndexT> void BM_IndexChurn(benchmark::State &state) {
+  const uint32_t count(state.range(0));
+  IndexT index(count);
+  std::vector<uint32_t> oids(count);
+  for (uint32_t oid = 0; oid < count; ++oid) {
+    oids[oid] = oid;
+    index.insert(oid, OrderLocation{Direction::Buy, oid, nullptr});
+  }
+  std::mt19937 rng(42);
+  uint32_t next(count);
+  for (auto _ : state) {
+    uint32_t &oid(oids[rng() % count]);
+    index.erase(oid);
+    oid = next++;
+    index.insert(oid, OrderLocation{Direction::Buy, oid, nullptr});
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_IndexChurn, SlotIndex)
+    ->RangeMultiplier(64)
+    ->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_IndexChurn, GroupedIndex)
+    ->RangeMultiplier(64)
+    ->Range(1 << 10, 1 << 22);
+
+// add fresh orders behind a queue that's already deep. Duplicate detection
+// shouldn't care how many orders are queued up at the price.
+void BM_AddByQueueLength(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  OrderBook book;
+  fillBook(book, depth, 1);
+
+  uint32_t oid(depth);
+  for (auto _ : state) {
+    OrderAction<Action::Add, Direction::Buy> action(oid++, 1, 1000);
+    book.handle(action, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddByQueueLength)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// cancel a random order out of one deep level, and put it back at the end
+void BM_RemoveByQueueLength(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  OrderBook book;
+  fillBook(book, depth, 1);
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> oids(0, depth - 1);
+  for (auto _ : state) {
+    const uint32_t oid(oids(rng));
+    OrderAction<Action::Remove, Direction::Buy> remove(oid, 0, 1000);
+    book.handle(remove, dummyCallback);
+    OrderAction<Action::Add, Direction::Buy> add(oid, 1, 1000);
+    book.handle(add, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RemoveByQueueLength)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// modify a random order out of one deep level: to less volume, which is done
+// in place, or to more, which cancels it and adds it again at the back
+void BM_ModifyByQueueLength(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  const bool more(0 != state.range(1));
+  OrderBook book;
+  std::vector<uint32_t> volumes(depth, 1u << 30);
+  for (uint32_t oid = 0; oid < depth; ++oid) {
+    OrderAction<Action::Add, Direction::Buy> add(oid, volumes[oid], 1000);
+    book.handle(add, dummyCallback);
+  }
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> oids(0, depth - 1);
+  for (auto _ : state) {
+    const uint32_t oid(oids(rng));
+    volumes[oid] = more ? volumes[oid] + 1 : volumes[oid] - 1;
+    OrderAction<Action::Modify, Direction::Buy> modify(oid, volumes[oid],
+                                                       1000);
+    book.handle(modify, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModifyByQueueLength)
+    ->ArgNames({"queue", "more"})
+    ->ArgsProduct({{8, 1 << 10, 1 << 15}, {0, 1}});
+
+// trade through the front of one deep level, topping it up at the back
+void BM_FillByQueueLength(benchmark::State &state) {
+  const uint32_t depth(state.range(0));
+  OrderBook book;
+  fillBook(book, depth, 1);
+
+  uint32_t oid(depth);
+  for (auto _ : state) {
+    OrderAction<Action::Add, Direction::Sell> sell(oid++, 1, 1000);
+    book.handle(sell, dummyCallback);
+    OrderAction<Action::Add, Direction::Buy> buy(oid++, 1, 1000);
+    book.handle(buy, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FillByQueueLength)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// five levels of L2 off a book with queueLength orders at each level. The
+// levels keep their own totals, so it shouldn't matter how long the queues are.
+void BM_DepthByQueueLength(benchmark::State &state) {
+  const uint32_t queueLength(state.range(0));
+  OrderBook book;
+  fillBook(book, queueLength * 5, 5);
+
+  LevelSummary levels[5];
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(book.getBids(levels, 5));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DepthByQueueLength)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// the latency benchmarks: one operation at a time through a book of resting
+// bids, by the number of levels and the orders queued at each, with
+// percentiles. See SampledLatencies.
+
+void BM_ClockOverhead(benchmark::State &state) {
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    latencies.time([] {});
+  }
+}
+BENCHMARK(BM_ClockOverhead)->UseManualTime();
+
+// a new order at one of the levels, taken out again untimed
+void BM_AddLatency(benchmark::State &state) {
+  const uint32_t levels(state.range(0));
+  const uint32_t depth(levels * state.range(1));
+  OrderBook book(depth + 1, levels);
+  fillBook(book, depth, levels);
+
+  std::mt19937 rng(42);
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    const uint32_t price(1000 + rng() % levels);
+    OrderAction<Action::Add, Direction::Buy> add(depth, 1, price);
+    latencies.time([&] { book.handle(add, dummyCallback); });
+    OrderAction<Action::Remove, Direction::Buy> remove(depth, 0, price);
+    book.handle(remove, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddLatency)
+    ->ArgNames({"levels", "queue"})
+    ->ArgsProduct({{16, 1024}, {1, 16, 256}})
+    ->UseManualTime();
+
+// a random resting order cancelled, and put back at the end of its queue
+// untimed
+void BM_CancelLatency(benchmark::State &state) {
+  const uint32_t levels(state.range(0));
+  const uint32_t depth(levels * state.range(1));
+  OrderBook book(depth, levels);
+  fillBook(book, depth, levels);
+
+  std::mt19937 rng(42);
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    const uint32_t oid(rng() % depth);
+    const uint32_t price(1000 + oid % levels);
+    OrderAction<Action::Remove, Direction::Buy> remove(oid, 0, price);
+    latencies.time([&] { book.handle(remove, dummyCallback); });
+    OrderAction<Action::Add, Direction::Buy> add(oid, 1 + oid % 8, price);
+    book.handle(add, dummyCallback);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CancelLatency)
+    ->ArgNames({"levels", "queue"})
+    ->ArgsProduct({{16, 1024}, {1, 16, 256}})
+    ->UseManualTime();
+
+// a random resting order moved to a random level
+void BM_ModifyLatency(benchmark::State &state) {
+  const uint32_t levels(state.range(0));
+  const uint32_t depth(levels * state.range(1));
+  OrderBook book(depth, levels);
+  fillBook(book, depth, levels);
+
+  std::mt19937 rng(42);
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    OrderAction<Action::Modify, Direction::Buy> modify(
+        rng() % depth, 1 + rng() % 8, 1000 + rng() % levels);
+    latencies.time([&] { book.handle(modify, dummyCallback); });
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModifyLatency)
+    ->ArgNames({"levels", "queue"})
+    ->ArgsProduct({{16, 1024}, {1, 16, 256}})
+    ->UseManualTime();
+
+// one sell order that trades through every order on all the levels, which
+// get put back untimed. Items are the trades.
+void BM_SweepLatency(benchmark::State &state) {
+  const uint32_t levels(state.range(0));
+  const uint32_t depth(levels * state.range(1));
+  OrderBook book(depth + 1, levels);
+  fillBook(book, depth, levels);
+  uint32_t volume(0);
+  for (uint32_t oid = 0; oid < depth; ++oid) {
+    volume += 1 + oid % 8;
+  }
+
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    OrderAction<Action::Add, Direction::Sell> sweep(depth, volume, 1000);
+    latencies.time([&] { book.handle(sweep, dummyCallback); });
+    fillBook(book, depth, levels);
+  }
+  state.SetItemsProcessed(state.iterations() * depth);
+}
+BENCHMARK(BM_SweepLatency)
+    ->ArgNames({"levels", "queue"})
+    ->ArgsProduct({{1, 8, 64}, {1, 16}})
+    ->UseManualTime();
+
+// the same feed through books with different price ladders, for as many
+// pairs of orders as it's given
+template <typename BookT> void BM_ReplayGenR(benchmark::State &state) {
+  GenRWorkload workload;
+  std::vector<Message> messages;
+  for (int64_t n = 0; n < state.range(0) * 4; ++n) {
+    messages.push_back(workload.next());
+  }
+  for (auto _ : state) {
+    BookT book;
+    replay(book, messages);
+    benchmark::DoNotOptimize(book.getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK_TEMPLATE(BM_ReplayGenR, OrderBook)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_ReplayGenR, ArrayOrderBook)->Arg(50000);
+
+// the generator's flow, with its cancels and modifies for resting orders,
+// over 1 and 64 symbols
+template <typename BookT> void BM_ReplayFlow(benchmark::State &state) {
+  WorkloadOptions options;
+  options.symbols = state.range(0);
+  Workload workload(options);
+  std::vector<Message> messages;
+  for (uint32_t n = 0; n < 1000000; ++n) {
+    messages.push_back(workload.next());
+  }
+  for (auto _ : state) {
+    BookManager<BookT> books(options.symbols);
+    replay(books, messages);
+    benchmark::DoNotOptimize(books[0].getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK_TEMPLATE(BM_ReplayFlow, OrderBook)->Arg(1)->Arg(64);
+BENCHMARK_TEMPLATE(BM_ReplayFlow, ArrayOrderBook)->Arg(1)->Arg(64);
+
+// the generator's flow over 64 symbols, deep enough that the books don't fit
+// in cache, a batch at a time - by the batch size and how many messages
+// ahead it prefetches. A lookahead of 0 is the same as a message at a time.
+// The books are built up first, untimed, so it's only the flow through books
+// that are already deep that counts.
+template <typename BookT> void BM_ReplayBatch(benchmark::State &state) {
+  static const uint32_t warmUp(1000000);
+  static const std::vector<Message> messages([] {
+    WorkloadOptions options;
+    options.symbols = 64;
+    options.resting = 20000;
+    Workload workload(options);
+    std::vector<Message> messages;
+    for (uint32_t n = 0; n < warmUp + 2000000; ++n) {
+      messages.push_back(workload.next());
+    }
+    return messages;
+  }());
+  const std::size_t batch(state.range(0));
+  const std::size_t lookahead(state.range(1));
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<BookManager<BookT>> books(
+        new BookManager<BookT>(64, 40000, 1024));
+    Processor<BookManager<BookT>> processor(*books);
+    processor.process(messages.data(), warmUp, nullptr, dummyCallback, 0);
+    state.ResumeTiming();
+    for (std::size_t from = warmUp; from < messages.size(); from += batch) {
+      processor.process(&messages[from],
+                        std::min(batch, messages.size() - from), nullptr,
+                        dummyCallback, lookahead);
+    }
+    benchmark::DoNotOptimize((*books)[0].getMidPrice());
+    state.PauseTiming();
+    books.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * (messages.size() - warmUp));
+}
+BENCHMARK_TEMPLATE(BM_ReplayBatch, OrderBook)
+    ->ArgNames({"batch", "lookahead"})
+    ->ArgsProduct({{1, 16, 256, 4096}, {0, 2, 4, 8, 16, 32}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ReplayBatch, ArrayOrderBook)
+    ->ArgNames({"batch", "lookahead"})
+    ->ArgsProduct({{256}, {0, 2, 4, 8, 16, 32}})
+    ->Unit(benchmark::kMillisecond);
+
+template <typename BookT> void BM_ReplayTouch(benchmark::State &state) {
+  const auto messages(touchMessages(state.range(0)));
+  for (auto _ : state) {
+    BookT book;
+    replay(book, messages);
+    benchmark::DoNotOptimize(book.getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK_TEMPLATE(BM_ReplayTouch, OrderBook)->Arg(1000000);
+BENCHMARK_TEMPLATE(BM_ReplayTouch, ArrayOrderBook)->Arg(1000000);
+// and publishing snapshots of the top 5 levels along the way
+BENCHMARK_TEMPLATE(BM_ReplayTouch, PublishedBook<OrderBook>)->Arg(1000000);
+BENCHMARK_TEMPLATE(BM_ReplayTouch, PublishedBook<ArrayOrderBook>)
+    ->Arg(1000000);
+
+// the touch feed with cancels that get turned down mixed in, this many out of
+// 100 messages - orders that were cancelled already, like the ones a feed
+// sends for orders that traded before the cancel got there. Turned down with
+// a Result, or with the exception that goes with it thrown and caught, which
+// is what every one of them used to cost.
+void BM_ReplayRejects(benchmark::State &state) {
+  const auto touch(touchMessages(1000000));
+  std::mt19937 rng(42);
+  std::vector<Message> messages;
+  std::vector<Message> cancelled;
+  for (const Message &message : touch) {
+    messages.push_back(message);
+    if (Action::Remove == message.action) {
+      cancelled.push_back(message);
+    }
+    while (!cancelled.empty() &&
+           rng() % 100 < static_cast<uint64_t>(state.range(0))) {
+      messages.push_back(cancelled[rng() % cancelled.size()]);
+    }
+  }
+  const bool throws(0 != state.range(1));
+  uint64_t rejected(0);
+  for (auto _ : state) {
+    OrderBook book;
+    Processor<OrderBook> processor(book);
+    for (const Message &message : messages) {
+      const Result result(processor.process(message, dummyCallback));
+      if (Result::Ok == result) {
+        continue;
+      }
+      ++rejected;
+      if (throws) {
+        try {
+          throwOnError(result, message.symbol, message.oid);
+        } catch (const OrderBookError &e) {
+          benchmark::DoNotOptimize(e.what());
+        }
+      }
+    }
+    benchmark::DoNotOptimize(book.getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+  state.counters["rejected"] =
+      static_cast<double>(rejected) / state.iterations() / messages.size();
+}
+BENCHMARK(BM_ReplayRejects)
+    ->ArgNames({"rejects", "throw"})
+    ->ArgsProduct({{0, 10, 50}, {0, 1}});
+
+// the touch feed a line at a time through the Processor, parsing and all,
+// with the spread of the time per line
+void BM_ProcessLatency(benchmark::State &state) {
+  const auto lines(toLines(touchMessages(state.range(0))));
+  std::unique_ptr<OrderBook> book(new OrderBook);
+  std::unique_ptr<Processor<OrderBook>> processor(
+      new Processor<OrderBook>(*book));
+  std::size_t next(0);
+  SampledLatencies latencies(state);
+  for (auto _ : state) {
+    if (lines.size() == next) {
+      // from the top, with an empty book
+      processor.reset(nullptr);
+      book.reset(new OrderBook);
+      processor.reset(new Processor<OrderBook>(*book));
+      next = 0;
+    }
+    const std::string &line(lines[next++]);
+    latencies.time([&] { processor->process(line, dummyCallback); });
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ProcessLatency)->Arg(1000000)->UseManualTime();
+
+// what timing a message costs main when it's built with ORDERBOOK_LATENCY:
+// two TSC reads and a histogram bucket
+void BM_MessageLatencies(benchmark::State &state) {
+  std::ostringstream os;
+  MessageLatencies latencies(os);
+  for (auto _ : state) {
+    latencies.stop(latencies.start(), MessageShape::Add);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MessageLatencies);
+
+// the touch feed spread over a number of symbols, each with a book of its own
+void BM_ReplayTouchSymbols(benchmark::State &state) {
+  auto messages(touchMessages(1000000));
+  for (Message &message : messages) {
+    message.symbol = message.oid % state.range(0);
+  }
+  for (auto _ : state) {
+    BookManager<OrderBook> books(state.range(0), 64, 16);
+    replay(books, messages);
+    benchmark::DoNotOptimize(books[0].getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK(BM_ReplayTouchSymbols)->RangeMultiplier(16)->Range(1, 4096);
+
+// loading a saved book back, by the number of orders resting in it over 1000
+// levels. Against replaying the input that got the book there, it's the
+// orders that count rather than the messages.
+template <typename BookT> void BM_RestoreState(benchmark::State &state) {
+  OrderBook book;
+  fillBook(book, state.range(0), 1000);
+  std::ostringstream os;
+  writeState(os, book, 0);
+  const std::string data(os.str());
+  for (auto _ : state) {
+    BookT restored(state.range(0), 1000);
+    restoreState(restored, BookState(data.data(), data.size()));
+    benchmark::DoNotOptimize(restored.getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_RestoreState, OrderBook)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18);
+BENCHMARK_TEMPLATE(BM_RestoreState, ArrayOrderBook)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18);
+
+// what journaling costs whoever's matching: copying an entry into the ring,
+// and waiting if the journal thread has fallen behind. It's writing to
+// /dev/null, so that's only when it doesn't get scheduled.
+void BM_JournalAppend(benchmark::State &state) {
+  const int fd(::open("/dev/null", O_WRONLY));
+  Journal journal(fd);
+  const Message message{Action::Add, Direction::Buy, 1, 10, 100, 0};
+  uint64_t sequence(0);
+  for (auto _ : state) {
+    journal.message(++sequence, message);
+  }
+  journal.stop();
+  state.SetItemsProcessed(state.iterations());
+  state.counters["stalls"] = journal.stalls();
+  ::close(fd);
+}
+BENCHMARK(BM_JournalAppend);
+
+// the touch feed with every message and trade journaled to a file, written
+// ( 0 ) or synced ( 1 ) a group at a time
+void BM_ReplayTouchJournaled(benchmark::State &state) {
+  const auto messages(touchMessages(1000000));
+  char path[] = "/tmp/orderbook-bench-XXXXXX";
+  const int fd(mkstemp(path));
+  for (auto _ : state) {
+    state.PauseTiming();
+    ::ftruncate(fd, 0);
+    state.ResumeTiming();
+    Journal journal(fd, state.range(0) ? Durability::Sync : Durability::Write);
+    OrderBook book;
+    Processor<OrderBook> processor(book);
+    uint64_t sequence(0);
+    auto cb = [&journal, &sequence](const Trade &trade) {
+      journal.trade(sequence, 0, trade);
+    };
+    for (const Message &message : messages) {
+      journal.message(++sequence, message);
+      processor.process(message, cb);
+    }
+    journal.stop();
+    benchmark::DoNotOptimize(book.getMidPrice());
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+  ::close(fd);
+  std::remove(path);
+}
+BENCHMARK(BM_ReplayTouchJournaled)->Arg(0)->Arg(1)->UseRealTime();
+
+// the touch feed over 64 symbols, spread over a number of worker threads. It
+// can only scale up to the number of cores there are, less the one
+// submitting.
+void BM_ShardedTouch(benchmark::State &state) {
+  auto messages(touchMessages(1000000));
+  for (Message &message : messages) {
+    message.symbol = message.oid % 64;
+  }
+  for (auto _ : state) {
+    ShardedEngine<OrderBook, decltype(dummyCallback)> engine(
+        state.range(0), dummyCallback, 4096, 1024, 64);
+    for (const Message &message : messages) {
+      engine.submit(message);
+    }
+    engine.stop();
+    benchmark::DoNotOptimize(engine.stats().messages);
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK(BM_ShardedTouch)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+// just the parsing, no book
+template <Message (*parse)(const char *, std::size_t)>
+void BM_Parse(benchmark::State &state) {
+  const auto lines(toLines(touchMessages(state.range(0))));
+  for (auto _ : state) {
+    for (const std::string &line : lines) {
+      benchmark::DoNotOptimize(parse(line.data(), line.size()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * lines.size());
+}
+BENCHMARK_TEMPLATE(BM_Parse, strtokParser::parseMessage)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_Parse, parseMessage)->Arg(100000);
+
+// writing out trades, the way main used to: a line at a time, flushed
+void BM_TradesEndl(benchmark::State &state) {
+  std::ofstream os("/dev/null");
+  uint32_t oid(0);
+  for (auto _ : state) {
+    os << "Trade " << Trade(oid, oid + 1, 10, 1000) << std::endl;
+    ++oid;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TradesEndl);
+
+// a threaded writer only has the error once its thread is done
+void stopWriter(FdWriter &) {}
+void stopWriter(ThreadedWriter &writer) { writer.stop(); }
+
+// and through a sink, unbatched ( a write per trade ) or batched
+template <typename Encoding, typename Writer>
+void BM_TradeSink(benchmark::State &state) {
+  const int fd(::open("/dev/null", O_WRONLY));
+  Writer writer(fd);
+  {
+    TradeSink<Encoding, Writer> sink(writer, 0 != state.range(0));
+    uint32_t oid(0);
+    for (auto _ : state) {
+      sink(Trade(oid, oid + 1, 10, 1000));
+      ++oid;
+    }
+  }
+  stopWriter(writer);
+  if (0 != writer.error()) {
+    state.SkipWithError(strerror(writer.error()));
+  }
+  ::close(fd);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_TradeSink, TextEncoding, FdWriter)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_TradeSink, TextEncoding, ThreadedWriter)->Arg(1);
+BENCHMARK_TEMPLATE(BM_TradeSink, BinaryEncoding, FdWriter)->Arg(1);
+
+BENCHMARK_MAIN();
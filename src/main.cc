@@ -1,62 +1,517 @@
 #include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
 
 #include "Actions.h"
+#include "BinaryFeed.h"
+#include "BookManager.h"
+#include "BookState.h"
 #include "Enums.h"
 #include "Exceptions.h"
+#include "Journal.h"
+#include "Latency.h"
+#include "MappedFile.h"
 #include "Order.h"
 #include "OrderBook.h"
+#include "Parser.h"
 #include "Processor.h"
+#include "ShardedEngine.h"
+#include "TradeSink.h"
 
-int main(int argc, char **argv) {
-  std::string line;
-  std::ifstream ifs(argv[1], std::ifstream::in);
-  const bool silent(argc == 3 && strncmp("silent", argv[2], 6) == 0);
+// symbols spread over worker threads, with this one just reading and parsing.
+// Books aren't printed as it goes, their messages interleave across threads.
+// There's a worker for each callback, which gets that worker's trades.
+template <typename FillsCallback>
+int runSharded(mvs::orderbook::MappedFile &input,
+               const std::vector<FillsCallback> &callbacks) {
+  using EngineT =
+      mvs::orderbook::ShardedEngine<mvs::orderbook::OrderBook, FillsCallback>;
+  EngineT engine(callbacks);
 
-  using BookT = mvs::orderbook::OrderBook;
-  using ProcessorT = mvs::orderbook::Processor<mvs::orderbook::OrderBook>;
+  uint32_t numLines(0);
+  uint32_t parseErrors(0);
 
-  auto cb = [silent](const mvs::orderbook::Trade &trade) {
-    if (!silent) {
-      std::cout << "Trade " << trade << std::endl;
+  if (mvs::orderbook::BinaryFeed::matches(input.data(), input.size())) {
+    const mvs::orderbook::BinaryFeed feed(input.data(), input.size());
+    for (const mvs::orderbook::Record &record : feed) {
+      numLines++;
+      engine.submit(mvs::orderbook::toMessage(record));
     }
-  };
+  } else {
+    const char *line;
+    std::size_t length;
+    while (input.getline(line, length)) {
+      numLines++;
+      try {
+        engine.submit(mvs::orderbook::parseMessage(line, length));
+      } catch (const mvs::orderbook::ParseError &e) {
+        std::cerr << e.what() << std::endl;
+        parseErrors++;
+      }
+    }
+  }
+  engine.stop();
 
-  BookT book;
-  ProcessorT processor(book);
+  const mvs::orderbook::ShardStats stats(engine.stats());
+  std::cout << numLines << " lines" << std::endl;
+  std::cout << stats.trades << " trades" << std::endl;
+  std::cout << stats.duplicateOrderIdErrors << " duplicate order ids"
+            << std::endl;
+  std::cout << stats.unknownOrderIdErrors << " unknown order ids" << std::endl;
+  std::cout << parseErrors + stats.parseErrors << " parse errors" << std::endl;
+  return 0;
+}
+
+// where the books get loaded from before the input, and saved to as it goes
+// and at the end, and where the messages and trades get journaled. Any of
+// them can be left out.
+struct Persistence {
+  const char *restore = nullptr;
+  const char *checkpoint = nullptr;
+  // messages between checkpoints, 0 for only at the end
+  uint64_t every = 0;
+  mvs::orderbook::Journal *journal = nullptr;
+  // messages between latency reports, 0 for only at the end. Only if it's
+  // built with them, see Latency.h.
+  uint64_t latencies = 0;
+};
+
+// one message after the other, on this thread. Unless it's silent, every
+// message and the book it touched get printed as it goes, and so do the
+// trades, unless they go to a sink.
+template <typename FillsCallback>
+int run(mvs::orderbook::MappedFile &input, bool silent,
+        const Persistence &persistence, FillsCallback &cb) {
+  using BooksT = mvs::orderbook::BookManager<mvs::orderbook::OrderBook>;
+  using ProcessorT = mvs::orderbook::Processor<BooksT>;
+
+  // symbol 0 is there from the start, the others come along as they're seen
+  BooksT books(1);
+  ProcessorT processor(books);
+
+  // counting the ones the restored books had already been through, which
+  // get skipped
+  uint64_t numLines(0);
+  if (nullptr != persistence.restore) {
+    try {
+      mvs::orderbook::MappedFile saved(persistence.restore);
+      const mvs::orderbook::BookState restored(saved.data(), saved.size());
+      numLines = mvs::orderbook::restoreState(books, restored);
+    } catch (const std::system_error &e) {
+      std::cerr << "can't restore " << persistence.restore << ": "
+                << e.code().message() << std::endl;
+      return 1;
+    } catch (const mvs::orderbook::OrderBookError &e) {
+      std::cerr << "can't restore " << persistence.restore << ": " << e.what()
+                << std::endl;
+      return 1;
+    }
+  }
+  const uint64_t skip(numLines);
 
-  uint32_t numLines(0);
   uint32_t duplicateOrderIdErrors(0);
   uint32_t unknownOrderIdErrors(0);
   uint32_t parseErrors(0);
 
-  while (std::getline(ifs, line)) {
+  // the book that was last touched
+  uint16_t symbol(0);
+
+  mvs::orderbook::Latencies latencies(std::cerr, persistence.latencies);
+  // the last message's, and all of them
+  uint32_t trades(0);
+  uint64_t totalTrades(0);
+
+  auto fills = [&](const mvs::orderbook::Trade &trade) {
+    ++trades;
+    ++totalTrades;
+    if (nullptr != persistence.journal) {
+      persistence.journal->trade(numLines, symbol, trade);
+    }
+    cb(trade);
+  };
+
+  auto reject = [&](const mvs::orderbook::Message &message,
+                    mvs::orderbook::Result result) {
+    mvs::orderbook::onError(
+        result, message.symbol, message.oid,
+        [](const auto &e) { std::cerr << e.what() << std::endl; });
+    switch (result) {
+    case mvs::orderbook::Result::DuplicateOrderId:
+      duplicateOrderIdErrors++;
+      break;
+    case mvs::orderbook::Result::UnknownOrderId:
+      unknownOrderIdErrors++;
+      break;
+    default:
+      parseErrors++;
+      break;
+    }
+  };
+
+  // false if the books couldn't be saved, which ends the run
+  auto save = [&] {
+    try {
+      mvs::orderbook::saveState(persistence.checkpoint, books, numLines);
+    } catch (const std::system_error &e) {
+      std::cerr << "failed writing " << e.what() << std::endl;
+      return false;
+    }
+    return true;
+  };
+
+  // every message goes the same way, whether it's a line of text or a record
+  // out of a binary feed. False if the run can't go on.
+  auto handle = [&](auto print, auto read) {
     numLines++;
     if (!silent) {
-      std::cout << line << std::endl;
+      print();
+      std::cout << '\n';
     }
 
     try {
-      processor.process(line, cb);
-    } catch (const mvs::orderbook::DuplicateOrderIdError &e) {
-      std::cerr << e.what() << std::endl;
-      duplicateOrderIdErrors++;
-    } catch (const mvs::orderbook::UnknownOrderIdError &e) {
-      std::cerr << e.what() << std::endl;
-      unknownOrderIdErrors++;
+      const mvs::orderbook::Message message(read());
+      symbol = message.symbol;
+      if (nullptr != persistence.journal) {
+        persistence.journal->message(numLines, message);
+      }
+      trades = 0;
+      const uint64_t started(latencies.start());
+      const mvs::orderbook::Result result(processor.process(message, fills));
+      if (likely(mvs::orderbook::Result::Ok == result)) {
+        latencies.stop(started,
+                       mvs::orderbook::shapeOf(message.action, trades));
+      } else {
+        latencies.stop(started, mvs::orderbook::MessageShape::Rejected);
+        reject(message, result);
+      }
     } catch (const mvs::orderbook::ParseError &e) {
       std::cerr << e.what() << std::endl;
       parseErrors++;
     }
     if (!silent) {
-      std::cout << book << std::endl;
+      std::cout << books[symbol] << '\n';
+    }
+    if (0u != persistence.every && 0u == numLines % persistence.every) {
+      return save();
+    }
+    return true;
+  };
+
+  if (mvs::orderbook::BinaryFeed::matches(input.data(), input.size())) {
+    const mvs::orderbook::BinaryFeed feed(input.data(), input.size());
+    if (skip > feed.size()) {
+      std::cerr << "the saved books are further along than the input"
+                << std::endl;
+      return 1;
+    }
+    // with nothing to do between one message and the next, they go through
+    // in batches, see Processor
+    const bool batched(silent && nullptr == persistence.journal &&
+                       0u == persistence.every &&
+                       !mvs::orderbook::Latencies::enabled);
+    const std::size_t batchSize(256);
+    std::vector<mvs::orderbook::Message> batch;
+    std::vector<mvs::orderbook::Result> results(batchSize);
+    for (const mvs::orderbook::Record *record = feed.begin() + skip;
+         record != feed.end();) {
+      if (!batched) {
+        if (!handle(
+                [record] { std::cout << mvs::orderbook::toMessage(*record); },
+                [record] { return mvs::orderbook::toMessage(*record); })) {
+          return 1;
+        }
+        ++record;
+        continue;
+      }
+      batch.clear();
+      for (; record != feed.end() && batch.size() < batchSize; ++record) {
+        batch.push_back(mvs::orderbook::toMessage(*record));
+      }
+      processor.process(batch.data(), batch.size(), results.data(), fills);
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (unlikely(mvs::orderbook::Result::Ok != results[i])) {
+          reject(batch[i], results[i]);
+        }
+      }
+      numLines += batch.size();
+    }
+  } else {
+    const char *line;
+    std::size_t length;
+    for (uint64_t skipped = 0; skipped < skip; ++skipped) {
+      if (!input.getline(line, length)) {
+        std::cerr << "the saved books are further along than the input"
+                  << std::endl;
+        return 1;
+      }
+    }
+    while (input.getline(line, length)) {
+      if (!handle([&] { std::cout.write(line, length); },
+                  [&] { return mvs::orderbook::parseMessage(line, length); })) {
+        return 1;
+      }
     }
   }
 
   std::cout << numLines << " lines" << std::endl;
+  std::cout << totalTrades << " trades" << std::endl;
   std::cout << duplicateOrderIdErrors << " duplicate order ids" << std::endl;
   std::cout << unknownOrderIdErrors << " unknown order ids" << std::endl;
   std::cout << parseErrors << " parse errors" << std::endl;
+  latencies.report();
+  if (nullptr != persistence.checkpoint && !save()) {
+    return 1;
+  }
+  return 0;
+}
+
+// trades encoded into batches, written to fd by a writer of the given kind.
+// A write that fails stops the trades going out, and fails the run once the
+// input's been through.
+template <typename Encoding>
+int runWithSink(mvs::orderbook::MappedFile &input, bool silent,
+                const Persistence &persistence, int fd, const char *path,
+                const std::string &writer) {
+  using namespace mvs::orderbook;
+  int result(0);
+  int error(0);
+  if ("thread" == writer) {
+    ThreadedWriter threaded(fd);
+    {
+      TradeSink<Encoding, ThreadedWriter> sink(threaded);
+      result = run(input, silent, persistence, sink);
+    }
+    threaded.stop();
+    error = threaded.error();
+  } else {
+    FdWriter direct(fd);
+    {
+      TradeSink<Encoding, FdWriter> sink(direct, "unbuffered" != writer);
+      result = run(input, silent, persistence, sink);
+    }
+    error = direct.error();
+  }
+  if (0 != error) {
+    std::cerr << "failed writing " << path << ": " << strerror(error)
+              << std::endl;
+    return 1;
+  }
+  return result;
+}
+
+// each worker's trades encoded into batches of its own, written to fd. A batch
+// is no more than PIPE_BUF bytes and goes out in a single write, so batches
+// from different workers never get mixed up, not even in a pipe. A symbol's
+// trades stay in order, but the trades of symbols on different workers are
+// interleaved a batch at a time.
+template <typename Encoding>
+int runShardedWithSink(mvs::orderbook::MappedFile &input, std::size_t shards,
+                       int fd, const char *path, bool batched) {
+  using namespace mvs::orderbook;
+  using SinkT = TradeSink<Encoding, FdWriter>;
+  std::vector<std::unique_ptr<FdWriter>> writers;
+  std::vector<std::unique_ptr<SinkT>> sinks;
+  auto forward = [](SinkT *sink) {
+    return [sink](const Trade &trade) { (*sink)(trade); };
+  };
+  std::vector<decltype(forward(nullptr))> callbacks;
+  for (std::size_t i = 0; i < shards; ++i) {
+    writers.emplace_back(new FdWriter(fd, PIPE_BUF));
+    sinks.emplace_back(new SinkT(*writers.back(), batched));
+    callbacks.push_back(forward(sinks.back().get()));
+  }
+  const int result(runSharded(input, callbacks));
+  // the workers are done, what's left of their batches goes out
+  sinks.clear();
+  for (const auto &written : writers) {
+    if (0 != written->error()) {
+      std::cerr << "failed writing " << path << ": "
+                << strerror(written->error()) << std::endl;
+      return 1;
+    }
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " input-file [silent] [shards=N] [trades=output-file"
+                 " [format=text|binary] [writer=buffered|thread|unbuffered]]"
+                 " [restore=state-file] [checkpoint=state-file [every=N]]"
+                 " [journal=journal-file [durability=write|sync]]"
+                 " [latencies=N]"
+              << std::endl;
+    return 1;
+  }
+  std::unique_ptr<mvs::orderbook::MappedFile> mapped;
+  try {
+    mapped.reset(new mvs::orderbook::MappedFile(argv[1]));
+  } catch (const std::system_error &e) {
+    std::cerr << "can't read " << argv[1] << ": " << e.code().message()
+              << std::endl;
+    return 1;
+  }
+  mvs::orderbook::MappedFile &input(*mapped);
+  bool silent(false);
+  std::size_t shards(0);
+  const char *trades(nullptr);
+  std::string format("text");
+  std::string writer("buffered");
+  Persistence persistence;
+  const char *journal(nullptr);
+  std::string durability("write");
+  for (int i = 2; i < argc; ++i) {
+    if (strncmp("silent", argv[i], 6) == 0) {
+      silent = true;
+    } else if (strncmp("shards=", argv[i], 7) == 0) {
+      shards = strtoul(argv[i] + 7, nullptr, 10);
+    } else if (strncmp("trades=", argv[i], 7) == 0) {
+      trades = argv[i] + 7;
+    } else if (strncmp("format=", argv[i], 7) == 0) {
+      format = argv[i] + 7;
+    } else if (strncmp("writer=", argv[i], 7) == 0) {
+      writer = argv[i] + 7;
+    } else if (strncmp("restore=", argv[i], 8) == 0) {
+      persistence.restore = argv[i] + 8;
+    } else if (strncmp("checkpoint=", argv[i], 11) == 0) {
+      persistence.checkpoint = argv[i] + 11;
+    } else if (strncmp("every=", argv[i], 6) == 0) {
+      persistence.every = strtoull(argv[i] + 6, nullptr, 10);
+    } else if (strncmp("journal=", argv[i], 8) == 0) {
+      journal = argv[i] + 8;
+    } else if (strncmp("durability=", argv[i], 11) == 0) {
+      durability = argv[i] + 11;
+    } else if (strncmp("latencies=", argv[i], 10) == 0) {
+      persistence.latencies = strtoull(argv[i] + 10, nullptr, 10);
+      if (!mvs::orderbook::Latencies::enabled) {
+        std::cerr << "latencies aren't built in, see 'make build-latency'"
+                  << std::endl;
+      }
+    }
+  }
+  if (nullptr == persistence.checkpoint) {
+    persistence.every = 0;
+  }
+  if (0u != shards) {
+    if (nullptr != persistence.restore || nullptr != persistence.checkpoint ||
+        nullptr != journal) {
+      std::cerr << "books can't be saved, restored or journaled when sharded"
+                << std::endl;
+      return 1;
+    }
+    if (nullptr == trades) {
+      const std::vector<void (*)(const mvs::orderbook::Trade &)> callbacks(
+          shards, [](const mvs::orderbook::Trade &) {});
+      return runSharded(input, callbacks);
+    }
+    // the workers write for themselves, appending so they don't write over
+    // each other
+    if ("thread" == writer) {
+      std::cerr << "writer=thread isn't there when sharded" << std::endl;
+      return 1;
+    }
+    const int fd(
+        ::open(trades, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644));
+    if (fd < 0) {
+      std::cerr << "can't write " << trades << ": " << strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    const bool batched("unbuffered" != writer);
+    const int result(
+        "binary" == format
+            ? runShardedWithSink<mvs::orderbook::BinaryEncoding>(
+                  input, shards, fd, trades, batched)
+            : runShardedWithSink<mvs::orderbook::TextEncoding>(
+                  input, shards, fd, trades, batched));
+    ::close(fd);
+    return result;
+  }
+
+  // a checkpoint that can't be written is found out now rather than once the
+  // input's been through
+  if (nullptr != persistence.checkpoint) {
+    const std::string temp(std::string(persistence.checkpoint) + ".tmp");
+    const int fd(::open(temp.c_str(), O_WRONLY | O_CREAT, 0644));
+    if (fd < 0) {
+      std::cerr << "can't write " << temp << ": " << strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    ::close(fd);
+    ::unlink(temp.c_str());
+  }
+
+  // picking up from a saved state, the journal goes on from where it was,
+  // otherwise it starts over
+  int journalFd(-1);
+  std::unique_ptr<mvs::orderbook::Journal> journaled;
+  if (nullptr != journal) {
+    journalFd = ::open(journal,
+                       O_WRONLY | O_CREAT |
+                           (nullptr != persistence.restore ? O_APPEND
+                                                           : O_TRUNC),
+                       0644);
+    if (journalFd < 0) {
+      std::cerr << "can't write " << journal << ": " << strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    try {
+      journaled.reset(new mvs::orderbook::Journal(
+          journalFd, "sync" == durability
+                         ? mvs::orderbook::Durability::Sync
+                         : mvs::orderbook::Durability::Write));
+    } catch (const std::system_error &e) {
+      std::cerr << "can't write " << journal << ": " << e.code().message()
+                << std::endl;
+      ::close(journalFd);
+      return 1;
+    }
+    persistence.journal = journaled.get();
+  }
+
+  int result(0);
+  if (nullptr != trades) {
+    const int fd(::open(trades, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (fd < 0) {
+      std::cerr << "can't write " << trades << std::endl;
+      return 1;
+    }
+    result = "binary" == format
+                 ? runWithSink<mvs::orderbook::BinaryEncoding>(
+                       input, silent, persistence, fd, trades, writer)
+                 : runWithSink<mvs::orderbook::TextEncoding>(
+                       input, silent, persistence, fd, trades, writer);
+    ::close(fd);
+  } else {
+    auto cb = [silent](const mvs::orderbook::Trade &trade) {
+      if (!silent) {
+        std::cout << "Trade " << trade << '\n';
+      }
+    };
+    result = run(input, silent, persistence, cb);
+  }
+
+  if (journaled) {
+    journaled->stop();
+    if (0 != journaled->error()) {
+      std::cerr << "failed writing " << journal << ": "
+                << strerror(journaled->error()) << std::endl;
+      result = 1;
+    }
+    ::close(journalFd);
+  }
+  return result;
 }
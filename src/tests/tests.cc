@@ -1,13 +1,43 @@
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <tuple>
 
 #include "../Actions.h"
+#include "../BinaryFeed.h"
+#include "../BookManager.h"
+#include "../BookState.h"
 #include "../Exceptions.h"
+#include "../Journal.h"
+#include "../Latency.h"
+#include "../Level.h"
+#include "../LevelChanges.h"
+#include "../MappedFile.h"
 #include "../Order.h"
 #include "../OrderBook.h"
+#include "../OrderIndex.h"
+#include "../OrderPool.h"
+#include "../Parser.h"
+#include "../PriceLadder.h"
 #include "../Processor.h"
+#include "../Seqlock.h"
+#include "../ShardedEngine.h"
+#include "../Snapshot.h"
+#include "../SpscRing.h"
+#include "../TradeSink.h"
+#include "../Workload.h"
 
 using namespace mvs::orderbook;
 
@@ -21,6 +51,30 @@ TEST(ExceptionsTests, UnknownOrderIdError) {
   ASSERT_STREQ("unknown oid 388075", UnknownOrderIdError(388075).what());
 }
 
+// the words for a Result are the matching exception's
+TEST(ExceptionsTests, OnError) {
+  std::vector<std::string> said;
+  auto say = [&said](const auto &e) { said.push_back(e.what()); };
+  onError(Result::Ok, 7, 388075, say);
+  ASSERT_TRUE(said.empty());
+  onError(Result::DuplicateOrderId, 7, 388075, say);
+  onError(Result::UnknownOrderId, 7, 388075, say);
+  onError(Result::UnknownSymbol, 7, 388075, say);
+  ASSERT_EQ(std::vector<std::string>(
+                {"duplicate oid 388075", "unknown oid 388075",
+                 "unknown symbol 7"}),
+            said);
+
+  ASSERT_NO_THROW(throwOnError(Result::Ok, 7, 388075));
+  ASSERT_THROW(throwOnError(Result::DuplicateOrderId, 7, 388075),
+               DuplicateOrderIdError);
+  ASSERT_THROW(throwOnError(Result::UnknownOrderId, 7, 388075),
+               UnknownOrderIdError);
+  ASSERT_THROW(throwOnError(Result::UnknownSymbol, 7, 388075),
+               UnknownSymbolError);
+  ASSERT_THROW(throwOnError(Result::BadMessage, 7, 388075), ParseError);
+}
+
 TEST(ExceptionsTests, ParseError) {
   ASSERT_STREQ("parse error: 'FOO BAR'", ParseError("FOO BAR").what());
 }
@@ -62,11 +116,362 @@ TEST(OrderTests, Basic) {
   ASSERT_EQ(33, order.getVolume());
 }
 
+TEST(LevelTests, Basic) {
+  using ActionT = OrderAction<Action::Add, Direction::Buy>;
+  OrderPool pool;
+  Level level;
+  ASSERT_TRUE(level.empty());
+
+  std::vector<Order *> orders;
+  for (uint32_t oid = 0; oid < 5; ++oid) {
+    orders.push_back(pool.create(ActionT(oid, oid + 10, 45.0)));
+    level.push_back(orders.back());
+  }
+  ASSERT_EQ(5u, level.size());
+  ASSERT_EQ(60u, level.volume());
+  ASSERT_EQ(0u, level.front().getOid());
+  ASSERT_EQ(4u, level.back().getOid());
+
+  auto oids = [&level]() {
+    std::vector<uint32_t> oids;
+    for (const Order &order : level) {
+      oids.push_back(order.getOid());
+    }
+    return oids;
+  };
+
+  // out of the middle, and off both ends
+  level.erase(orders[2]);
+  ASSERT_EQ(std::vector<uint32_t>({0, 1, 3, 4}), oids());
+  ASSERT_EQ(48u, level.volume());
+  level.reduce(*orders[3], 3);
+  ASSERT_EQ(10u, orders[3]->getVolume());
+  ASSERT_EQ(45u, level.volume());
+  level.erase(orders[4]);
+  ASSERT_EQ(3u, level.back().getOid());
+  ASSERT_EQ(orders[0], level.pop_front());
+  ASSERT_EQ(std::vector<uint32_t>({1, 3}), oids());
+
+  // moving the level takes the orders along
+  Level other(std::move(level));
+  ASSERT_TRUE(level.empty());
+  ASSERT_EQ(2u, other.size());
+  ASSERT_EQ(1u, other.front().getOid());
+
+  // and orders that were taken out can go back in at the end
+  other.push_back(orders[0]);
+  ASSERT_EQ(0u, other.back().getOid());
+  ASSERT_EQ(3u, other.size());
+}
+
+TEST(OrderPoolTests, Basic) {
+  using ActionT = OrderAction<Action::Add, Direction::Sell>;
+  OrderPool pool(100);
+  const std::size_t capacity(pool.capacity());
+  ASSERT_GE(capacity, 100u);
+
+  std::vector<Order *> orders;
+  for (uint32_t oid = 0; oid < capacity; ++oid) {
+    orders.push_back(pool.create(ActionT(oid, 1, 45.0)));
+  }
+  ASSERT_EQ(capacity, pool.size());
+  ASSERT_EQ(capacity, pool.capacity());
+
+  // released orders get handed out again before the pool grows
+  pool.release(orders[10]);
+  Order *order(pool.create(ActionT(1234, 5, 46.0)));
+  ASSERT_EQ(orders[10], order);
+  ASSERT_EQ(1234u, order->getOid());
+  ASSERT_EQ(5u, order->getVolume());
+  ASSERT_EQ(capacity, pool.capacity());
+
+  // full up, so it grows - and the orders we have stay where they are
+  Order *extra(pool.create(ActionT(4321, 1, 45.0)));
+  ASSERT_GT(pool.capacity(), capacity);
+  ASSERT_EQ(4321u, extra->getOid());
+  ASSERT_EQ(0u, orders[0]->getOid());
+  ASSERT_EQ(capacity + 1, pool.size());
+}
+
+// check with GroupedIndex probing every way the CPU can, not just the best
+template <typename Check> void forEachSimd(Check check) {
+  for (Simd level : {Simd::Scalar, Simd::Sse2, Simd::Avx2}) {
+    if (level <= simdSupported()) {
+      SCOPED_TRACE(static_cast<int>(level));
+      forceSimd(level);
+      check();
+    }
+  }
+  forceSimd(simdSupported());
+}
+
+template <typename IndexT> void checkIndexBasic() {
+  IndexT index;
+  ASSERT_TRUE(index.empty());
+  ASSERT_TRUE(index.insert(12, OrderLocation{Direction::Buy, 45}));
+  ASSERT_TRUE(index.insert(0, OrderLocation{Direction::Sell, 46}));
+  // already known, whatever the side or price
+  ASSERT_FALSE(index.insert(12, OrderLocation{Direction::Sell, 47}));
+  ASSERT_EQ(2u, index.size());
+
+  ASSERT_TRUE(index.contains(0));
+  ASSERT_EQ(Direction::Sell, index.find(0)->dir);
+  ASSERT_EQ(46u, index.find(0)->price);
+  ASSERT_EQ(Direction::Buy, index.find(12)->dir);
+  ASSERT_EQ(45u, index.find(12)->price);
+
+  index.erase(12);
+  ASSERT_EQ(nullptr, index.find(12));
+  ASSERT_FALSE(index.contains(12));
+  // erasing something unknown is fine
+  index.erase(12);
+  ASSERT_EQ(1u, index.size());
+
+  // every oid is a valid one
+  ASSERT_TRUE(index.insert(~uint32_t(0), OrderLocation{Direction::Buy, 48}));
+  ASSERT_EQ(48u, index.find(~uint32_t(0))->price);
+  ASSERT_EQ(nullptr, index.find(~uint32_t(0) - 1));
+}
+
+TEST(OrderIndexTests, Basic) {
+  checkIndexBasic<SlotIndex>();
+  forEachSimd([] { checkIndexBasic<GroupedIndex>(); });
+}
+
+template <typename IndexT> void checkIndexGrowth() {
+  // start small so we rehash a number of times, and erase every other oid so
+  // entries get shifted back into the holes
+  IndexT index(1);
+  const uint32_t count(100000);
+  for (uint32_t oid = 0; oid < count; ++oid) {
+    ASSERT_TRUE(index.insert(oid, OrderLocation{Direction::Buy, oid % 97}));
+  }
+  ASSERT_EQ(count, index.size());
+  ASSERT_GE(index.capacity(), count);
+  for (uint32_t oid = 0; oid < count; oid += 2) {
+    index.erase(oid);
+  }
+  ASSERT_EQ(count / 2, index.size());
+  for (uint32_t oid = 0; oid < count; ++oid) {
+    if (oid % 2) {
+      ASSERT_NE(nullptr, index.find(oid));
+      ASSERT_EQ(oid % 97, index.find(oid)->price);
+    } else {
+      ASSERT_EQ(nullptr, index.find(oid));
+    }
+  }
+}
+
+TEST(OrderIndexTests, Growth) {
+  checkIndexGrowth<SlotIndex>();
+  forEachSimd([] { checkIndexGrowth<GroupedIndex>(); });
+}
+
+// oids that all hash to the last few slots, so the clusters are long, span
+// groups and wrap around the end of the table - against a map, through
+// inserts and erases in any order
+template <typename IndexT> void checkIndexClusters() {
+  // 64 slots to start with, so the top 6 bits of oid * 2654435769 are the
+  // home slot
+  IndexT index(32);
+  const std::size_t slots(index.capacity() * 2);
+  std::vector<uint32_t> oids;
+  for (uint32_t oid = 0; oids.size() < index.capacity(); ++oid) {
+    const std::size_t home((oid * 2654435769u) >> 26);
+    if (home + 6 >= slots) {
+      oids.push_back(oid);
+    }
+  }
+  std::mt19937 rng(3);
+  std::map<uint32_t, uint32_t> expected;
+  for (uint32_t n = 0; n < 20000; ++n) {
+    const uint32_t oid(oids[rng() % oids.size()]);
+    if (rng() % 2) {
+      ASSERT_EQ(0u == expected.count(oid),
+                index.insert(oid, OrderLocation{Direction::Buy, n}));
+      expected.emplace(oid, n);
+    } else {
+      index.erase(oid);
+      expected.erase(oid);
+    }
+    ASSERT_EQ(expected.size(), index.size());
+    ASSERT_EQ(slots, index.capacity() * 2);
+    for (uint32_t known : oids) {
+      const auto iter(expected.find(known));
+      if (iter == expected.end()) {
+        ASSERT_EQ(nullptr, index.find(known));
+      } else {
+        ASSERT_NE(nullptr, index.find(known));
+        ASSERT_EQ(iter->second, index.find(known)->price);
+      }
+    }
+  }
+}
+
+TEST(OrderIndexTests, Clusters) {
+  checkIndexClusters<SlotIndex>();
+  forEachSimd([] { checkIndexClusters<GroupedIndex>(); });
+}
+
+// however the oids get compared, they come out the same
+TEST(OrderIndexTests, Simd) {
+  alignas(64) uint32_t oids[details::oidGroup];
+  std::mt19937 rng(5);
+  for (uint32_t n = 0; n < 10000; ++n) {
+    for (uint32_t &oid : oids) {
+      oid = rng() % 4;
+    }
+    const uint32_t oid(rng() % 5);
+    uint32_t expected(0);
+    for (std::size_t lane = 0; lane < details::oidGroup; ++lane) {
+      expected |= (oids[lane] == oid ? 1u : 0u) << lane;
+    }
+    ASSERT_EQ(expected, details::matchScalar(oids, oid));
+#if defined(__x86_64__) || defined(__i386__)
+    if (Simd::Sse2 <= simdSupported()) {
+      ASSERT_EQ(expected, details::matchSse2(oids, oid));
+    }
+    if (Simd::Avx2 <= simdSupported()) {
+      ASSERT_EQ(expected, details::matchAvx2(oids, oid));
+    }
+#endif
+  }
+}
+
+TEST(PriceLadderTests, ArrayLadderSell) {
+  using LadderT = ArrayLadder<Direction::Sell>;
+  using ActionT = OrderAction<Action::Add, Direction::Sell>;
+  LadderT ladder;
+  OrderPool pool;
+  ASSERT_TRUE(ladder.empty());
+
+  auto prices = [&ladder]() {
+    std::vector<uint32_t> prices;
+    ladder.forEach([&prices](uint32_t price, const LadderT::LevelT &) {
+      prices.push_back(price);
+    });
+    return prices;
+  };
+
+  ladder[1000].push_back(pool.create(ActionT(1, 1, 1000)));
+  // too far out for the window, so it goes into the map
+  ladder[1000 + LadderT::windowTicks * 2].push_back(
+      pool.create(ActionT(2, 1, 1000 + LadderT::windowTicks * 2)));
+  ASSERT_EQ(2u, ladder.size());
+  ASSERT_EQ(1000u, ladder.front().first);
+  ASSERT_EQ(1u, ladder.front().second.front().getOid());
+
+  // the window runs empty, so it moves to what the map has
+  ladder.find(1000)->pop_front();
+  ladder.erase(1000);
+  ASSERT_EQ(1u, ladder.size());
+  ASSERT_EQ(1000 + LadderT::windowTicks * 2, ladder.front().first);
+  ASSERT_EQ(nullptr, ladder.find(1000));
+
+  // better than anything in the window, so the window moves back down
+  ladder[100].push_back(pool.create(ActionT(3, 1, 100)));
+  ladder[3000].push_back(pool.create(ActionT(4, 1, 3000)));
+  ASSERT_EQ(3u, ladder.size());
+  ASSERT_EQ(100u, ladder.front().first);
+  ASSERT_EQ(std::vector<uint32_t>({100, 3000, 1000 + LadderT::windowTicks * 2}),
+            prices());
+  ASSERT_NE(nullptr, ladder.find(1000 + LadderT::windowTicks * 2));
+
+  auto eraseFront = [&ladder]() {
+    ladder.front().second.pop_front();
+    ladder.eraseFront();
+  };
+  eraseFront();
+  ASSERT_EQ(3000u, ladder.front().first);
+  eraseFront();
+  ASSERT_EQ(1000 + LadderT::windowTicks * 2, ladder.front().first);
+  eraseFront();
+  ASSERT_TRUE(ladder.empty());
+}
+
+TEST(PriceLadderTests, ArrayLadderBuy) {
+  using LadderT = ArrayLadder<Direction::Buy>;
+  using ActionT = OrderAction<Action::Add, Direction::Buy>;
+  LadderT ladder;
+  OrderPool pool;
+
+  for (uint32_t price : {1000, 990, 1010, 1}) {
+    ladder[price].push_back(pool.create(ActionT(price, 1, price)));
+  }
+  ASSERT_EQ(4u, ladder.size());
+  ASSERT_EQ(1010u, ladder.front().first);
+
+  std::vector<uint32_t> prices;
+  ladder.forEach([&prices](uint32_t price, const LadderT::LevelT &) {
+    prices.push_back(price);
+  });
+  ASSERT_EQ(std::vector<uint32_t>({1010, 1000, 990, 1}), prices);
+
+  ladder.find(1000)->pop_front();
+  ladder.erase(1000);
+  ladder.front().second.pop_front();
+  ladder.eraseFront();
+  ASSERT_EQ(990u, ladder.front().first);
+  ASSERT_EQ(nullptr, ladder.find(1000));
+  ASSERT_NE(nullptr, ladder.find(1));
+}
+
+namespace {
+
+// a file with these contents for as long as it's in scope
+struct TempFile {
+  TempFile(const std::string &contents) {
+    char path[] = "/tmp/orderbook-tests-XXXXXX";
+    const int fd(mkstemp(path));
+    m_path = path;
+    FILE *file(fdopen(fd, "w"));
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+  }
+  ~TempFile() { std::remove(m_path.c_str()); }
+
+  std::string m_path;
+};
+
+std::vector<std::string> readLines(MappedFile &file) {
+  std::vector<std::string> lines;
+  const char *line;
+  std::size_t length;
+  while (file.getline(line, length)) {
+    lines.emplace_back(line, length);
+  }
+  return lines;
+}
+
+} // namespace
+
+TEST(MappedFileTests, Lines) {
+  TempFile temp("A,1,B,1,1\n\nX,1,B,1 // comment\r\nM,2,S,3,4");
+  MappedFile file(temp.m_path.c_str());
+  ASSERT_EQ(std::vector<std::string>(
+                {"A,1,B,1,1", "", "X,1,B,1 // comment\r", "M,2,S,3,4"}),
+            readLines(file));
+
+  // and again
+  file.rewind();
+  ASSERT_EQ(4u, readLines(file).size());
+}
+
+TEST(MappedFileTests, Empty) {
+  TempFile temp("");
+  MappedFile file(temp.m_path.c_str());
+  ASSERT_EQ(0u, file.size());
+  ASSERT_TRUE(readLines(file).empty());
+
+  ASSERT_THROW(MappedFile("/does/not/exist"), std::system_error);
+}
+
 struct MockBook {
   template <Action action, Direction direction, typename Callback>
-  void handle(OrderAction<action, direction> &oaction, Callback &) {
+  Result handle(OrderAction<action, direction> &oaction, Callback &) {
     store.emplace_back(action, direction, oaction.getOid(), oaction.getVolume(),
                        oaction.getPrice());
+    return Result::Ok;
   }
 
   using StoredActionT =
@@ -131,6 +536,415 @@ TEST(ProcessorTests, Errors) {
                ParseError);
 }
 
+TEST(ProcessorTests, NotNullTerminated) {
+  MockBook book;
+  Processor<MockBook> processor(book);
+
+  // only the first 14 characters are the line
+  const char *input("A,54321,B,3,77A,12345,S,1,75");
+  processor.process(input, 14, dummyCallback);
+  ASSERT_EQ(
+      MockBook::StoredActionT(Action::Add, Direction::Buy, 54321, 3, 77),
+      book.store.back());
+
+  try {
+    processor.process(input, 5, dummyCallback);
+    FAIL();
+  } catch (const ParseError &e) {
+    ASSERT_STREQ("parse error: 'A,543'", e.what());
+  }
+}
+
+TEST(ProcessorTests, LongLines) {
+  MockBook book;
+  Processor<MockBook> processor(book);
+
+  // a long comment is fine
+  processor.process("A,54321,B,3,77 // " + std::string(1000, 'x'),
+                    dummyCallback);
+  ASSERT_EQ(
+      MockBook::StoredActionT(Action::Add, Direction::Buy, 54321, 3, 77),
+      book.store.back());
+
+  // but a long line that's all message isn't
+  ASSERT_THROW(processor.process("A,54321,B,3,77" + std::string(1000, '7'),
+                                 dummyCallback),
+               ParseError);
+}
+
+// a batch comes out the same as its messages one at a time, however far it
+// looks ahead - turned down ones included
+template <typename BookT> void checkBatch() {
+  WorkloadOptions options;
+  options.symbols = 4;
+  options.resting = 300;
+  options.aggressive = 0.05;
+  options.immediates = 0.3;
+  Workload workload(options);
+  std::mt19937 rng(7);
+  std::vector<Message> messages;
+  for (uint32_t n = 0; n < 20000; ++n) {
+    messages.push_back(workload.next());
+    if (0u == rng() % 50) {
+      // the same again: a duplicate add, or a cancel for an order that's gone
+      messages.push_back(messages.back());
+    }
+    if (0u == rng() % 500) {
+      // a symbol that hasn't been seen yet, and a side that doesn't exist
+      messages.push_back(Message{Action::Add, Direction::Buy, 1, 1, 1, 9});
+      messages.push_back(
+          Message{Action::Add, static_cast<Direction>('Q'), 2, 1, 1, 0});
+    }
+  }
+
+  using TradeT = std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>;
+  auto replay = [&messages](std::size_t lookahead, std::size_t batch,
+                            std::vector<Result> &results,
+                            std::vector<TradeT> &trades) {
+    BookManager<BookT> books;
+    Processor<BookManager<BookT>> processor(books);
+    auto cb = [&trades](const Trade &trade) {
+      trades.emplace_back(trade.getBuyOid(), trade.getSellOid(),
+                          trade.getVolume(), trade.getPrice());
+    };
+    results.resize(messages.size());
+    std::size_t ok(0);
+    for (std::size_t from = 0; from < messages.size(); from += batch) {
+      const std::size_t count(std::min(batch, messages.size() - from));
+      if (0u == batch % 2) {
+        ok += processor.process(&messages[from], count, &results[from], cb,
+                                lookahead);
+      } else {
+        // without the results
+        ok += processor.process(&messages[from], count, nullptr, cb,
+                                lookahead);
+        for (std::size_t i = from; i < from + count; ++i) {
+          results[i] = Result::Ok;
+        }
+      }
+    }
+    std::ostringstream dump;
+    books.forEach([&dump](uint16_t symbol, const BookT &book) {
+      dump << symbol << book;
+    });
+    return std::make_pair(ok, dump.str());
+  };
+
+  std::vector<Result> expectedResults;
+  std::vector<TradeT> expectedTrades;
+  BookManager<BookT> books;
+  Processor<BookManager<BookT>> processor(books);
+  auto cb = [&expectedTrades](const Trade &trade) {
+    expectedTrades.emplace_back(trade.getBuyOid(), trade.getSellOid(),
+                                trade.getVolume(), trade.getPrice());
+  };
+  std::size_t expectedOk(0);
+  for (const Message &message : messages) {
+    expectedResults.push_back(processor.process(message, cb));
+    expectedOk += Result::Ok == expectedResults.back() ? 1 : 0;
+  }
+  std::ostringstream expected;
+  books.forEach([&expected](uint16_t symbol, const BookT &book) {
+    expected << symbol << book;
+  });
+  ASSERT_LT(expectedOk, messages.size());
+  ASSERT_LT(0u, expectedTrades.size());
+
+  for (std::size_t lookahead : {0, 1, 2, 8, 64, 100000}) {
+    for (std::size_t batch : {1, 16, 1000, 100000}) {
+      std::vector<Result> results;
+      std::vector<TradeT> trades;
+      const auto replayed(replay(lookahead, batch, results, trades));
+      ASSERT_EQ(expectedOk, replayed.first) << lookahead << " " << batch;
+      ASSERT_EQ(expected.str(), replayed.second) << lookahead << " " << batch;
+      ASSERT_EQ(expectedTrades, trades) << lookahead << " " << batch;
+      if (0u == batch % 2) {
+        ASSERT_EQ(expectedResults, results) << lookahead << " " << batch;
+      }
+    }
+  }
+
+  // a book on its own only has symbol 0, and looking ahead at a message for
+  // another one mustn't trip over that
+  BookT book;
+  Processor<BookT> single(book);
+  const Message others[] = {{Action::Add, Direction::Buy, 1, 1, 100, 0},
+                            {Action::Remove, Direction::Buy, 1, 0, 100, 3},
+                            {Action::Remove, Direction::Buy, 1, 0, 100, 0}};
+  Result results[3];
+  ASSERT_EQ(2u, single.process(others, 3, results, dummyCallback, 2));
+  ASSERT_EQ(Result::UnknownSymbol, results[1]);
+  ASSERT_TRUE(book.getIndex().empty());
+}
+
+TEST(ProcessorTests, Batch) {
+  checkBatch<OrderBook>();
+  checkBatch<ArrayOrderBook>();
+}
+
+TEST(ParserTests, Basic) {
+  const std::string line("A,100000,S,1,1075");
+  const Message message(parseMessage(line.data(), line.size()));
+  ASSERT_EQ(Action::Add, message.action);
+  ASSERT_EQ(Direction::Sell, message.dir);
+  ASSERT_EQ(100000u, message.oid);
+  ASSERT_EQ(1u, message.volume);
+  ASSERT_EQ(1075u, message.price);
+
+  for (const std::string &ok :
+       {"X,100004,B,950 // cancel", "X,100004,B,950//cancel",
+        "X,100004,B,950\r", "X,100004,B,950 \t// cancel"}) {
+    const Message remove(parseMessage(ok.data(), ok.size()));
+    ASSERT_EQ(Action::Remove, remove.action);
+    ASSERT_EQ(Direction::Buy, remove.dir);
+    ASSERT_EQ(100004u, remove.oid);
+    ASSERT_EQ(0u, remove.volume);
+    ASSERT_EQ(950u, remove.price);
+  }
+
+  for (const std::string &bad :
+       {"A,1,S,1,", "A,,S,1,2", "A,1,S,1,2,3", "A,1,S,1,2x", "AA,1,S,1,2",
+        "A,1,SS,1,2", "A,1,S,1", "X,1,S", "A,4294967296,S,1,2",
+        "A,99999999999,S,1,2", "A,1 ,S,1,2", "65536,A,1,S,1,2", "7A,1,S,1,2",
+        "7,7,A,1,S,1,2"}) {
+    ASSERT_THROW(parseMessage(bad.data(), bad.size()), ParseError) << bad;
+  }
+}
+
+TEST(ParserTests, OrderTypes) {
+  using ParsedT = std::tuple<Action, Direction, uint32_t, uint32_t, uint32_t>;
+  auto parse = [](const std::string &line) {
+    const Message message(parseMessage(line.data(), line.size()));
+    return ParsedT(message.action, message.dir, message.oid, message.volume,
+                   message.price);
+  };
+  ASSERT_EQ(ParsedT(Action::Ioc, Direction::Buy, 1, 5, 100),
+            parse("I,1,B,5,100"));
+  ASSERT_EQ(ParsedT(Action::Fok, Direction::Sell, 2, 6, 101),
+            parse("F,2,S,6,101 // all or nothing"));
+  ASSERT_EQ(ParsedT(Action::Market, Direction::Sell, 3, 7, 0),
+            parse("K,3,S,7"));
+  ASSERT_EQ(ParsedT(Action::Market, Direction::Buy, 3, 7, 0),
+            parse("K,3,B,7 // any price"));
+
+  for (const std::string &bad : {"K,3,S,7,100", "K,3,S", "I,1,B,5", "F,1,B",
+                                 "Q,1,B,5,100", "T,1,B,5,100"}) {
+    ASSERT_THROW(parseMessage(bad.data(), bad.size()), ParseError) << bad;
+  }
+
+  std::ostringstream os;
+  os << parseMessage("K,3,S,7", 7);
+  ASSERT_EQ("K,3,S,7", os.str());
+}
+
+// numbers of every length, both where the line goes on after them and where
+// it ends
+TEST(ParserTests, Numbers) {
+  std::mt19937 rng(42);
+  for (int i = 0; i < 100000; ++i) {
+    const uint32_t value(rng() >> (rng() % 32));
+    const std::string number(std::to_string(value));
+    const std::string leadingZeroes(std::string(rng() % 3, '0') + number);
+    for (const std::string &line :
+         {"A," + number + ",B," + leadingZeroes + "," + number,
+          "A,1,B," + leadingZeroes + "," + leadingZeroes + " // comment"}) {
+      const Message message(parseMessage(line.data(), line.size()));
+      ASSERT_EQ(value, message.volume) << line;
+      ASSERT_EQ(value, message.price) << line;
+    }
+  }
+  const std::string max("M,4294967295,S,4294967295,4294967295");
+  ASSERT_EQ(0u, parseMessage(max.data(), max.size()).symbol);
+  const Message message(parseMessage(max.data(), max.size()));
+  ASSERT_EQ(4294967295u, message.oid);
+  ASSERT_EQ(4294967295u, message.price);
+}
+
+TEST(ParserTests, Symbols) {
+  for (const std::string &line : {"65535,A,1,S,2,3", "00042,X,1,S,3"}) {
+    const Message message(parseMessage(line.data(), line.size()));
+    ASSERT_EQ(line[0] == '6' ? 65535u : 42u, message.symbol);
+    ASSERT_EQ(1u, message.oid);
+    ASSERT_EQ(3u, message.price);
+  }
+}
+
+TEST(BinaryFeedTests, Records) {
+  for (const std::string &line :
+       {"A,100000,S,1,1075", "M,4294967295,B,4294967295,4294967295",
+        "X,100004,B,950", "65535,A,1,B,2,3"}) {
+    const Record record(toRecord(parseMessage(line.data(), line.size())));
+    std::ostringstream os;
+    os << toMessage(record);
+    ASSERT_EQ(line, os.str());
+  }
+}
+
+TEST(BinaryFeedTests, Feed) {
+  std::ostringstream os;
+  writeFeedHeader(os);
+  for (const std::string &line : {"A,1,B,10,100", "X,1,B,100"}) {
+    writeRecord(os, toRecord(parseMessage(line.data(), line.size())));
+  }
+  const std::string data(os.str());
+  ASSERT_EQ(3 * sizeof(Record), data.size());
+  ASSERT_TRUE(BinaryFeed::matches(data.data(), data.size()));
+  ASSERT_FALSE(BinaryFeed::matches("A,1,B,10,100\nX,1,B,100", 22));
+
+  const BinaryFeed feed(data.data(), data.size());
+  ASSERT_EQ(2u, feed.size());
+  MockBook book;
+  Processor<MockBook> processor(book);
+  for (const Record &record : feed) {
+    processor.process(record, dummyCallback);
+  }
+  ASSERT_EQ(MockBook::StoredActionVctT(
+                {MockBook::StoredActionT(Action::Add, Direction::Buy, 1, 10,
+                                         100),
+                 MockBook::StoredActionT(Action::Remove, Direction::Buy, 1, 0,
+                                         100)}),
+            book.store);
+
+  // cut off halfway through a record
+  ASSERT_THROW(BinaryFeed(data.data(), data.size() - 1), ParseError);
+  std::string newer(data);
+  newer[sizeof(FeedHeader::magic)] = 2;
+  ASSERT_THROW(BinaryFeed(newer.data(), newer.size()), ParseError);
+}
+
+TEST(BookManagerTests, Routing) {
+  BookManager<OrderBook> books(2, 16, 4);
+  ASSERT_EQ(2u, books.size());
+  ASSERT_NE(nullptr, books.find(1));
+  ASSERT_EQ(nullptr, books.find(2));
+
+  Processor<BookManager<OrderBook>> processor(books);
+  std::vector<std::tuple<uint32_t, uint32_t>> trades;
+  auto cb = [&trades](const Trade &trade) {
+    trades.emplace_back(trade.getBuyOid(), trade.getSellOid());
+  };
+  // the same oids in different books are different orders
+  processor.process("A,1,B,10,100", cb);
+  processor.process("1,A,1,S,10,100", cb);
+  ASSERT_TRUE(trades.empty());
+  processor.process("9,A,1,B,10,100", cb);
+  processor.process("9,A,2,S,10,100", cb);
+  ASSERT_EQ(1u, trades.size());
+  ASSERT_EQ(std::make_tuple(1u, 2u), trades.back());
+
+  // books come along as symbols are seen
+  ASSERT_EQ(10u, books.size());
+  ASSERT_EQ(nullptr, books.find(5));
+  ASSERT_TRUE(books.find(9)->getBuySide().empty());
+  ASSERT_EQ(1u, books[0].getIndex().size());
+  ASSERT_EQ(1u, books[1].getIndex().size());
+  ASSERT_EQ(Result::UnknownOrderId, processor.process("1,X,1,B,100", cb));
+  processor.process("1,X,1,S,100", cb);
+  ASSERT_TRUE(books[1].getIndex().empty());
+
+  std::vector<uint16_t> symbols;
+  books.forEach([&symbols](uint16_t symbol, const OrderBook &) {
+    symbols.push_back(symbol);
+  });
+  ASSERT_EQ(std::vector<uint16_t>({0, 1, 9}), symbols);
+
+  // a book on its own is symbol 0
+  OrderBook book;
+  Processor<OrderBook> single(book);
+  single.process("0,A,1,B,10,100", dummyCallback);
+  ASSERT_EQ(Result::UnknownSymbol,
+            single.process("1,A,2,B,10,100", dummyCallback));
+  // a record can have any action or side at all
+  ASSERT_EQ(Result::BadMessage,
+            single.process(Record{'Q', 'B', 0, 3, 10, 100}, dummyCallback));
+  ASSERT_EQ(Result::BadMessage,
+            single.process(Record{'A', 'Q', 0, 3, 10, 100}, dummyCallback));
+  ASSERT_EQ(1u, book.getIndex().size());
+}
+
+namespace {
+
+// what a sink writes, read back once it's done
+template <typename Encoding, typename Writer>
+std::string sinkTrades(const std::vector<std::tuple<uint32_t, uint32_t>> &ids,
+                       bool batched = true) {
+  TempFile temp("");
+  const int fd(::open(temp.m_path.c_str(), O_WRONLY));
+  {
+    // a small buffer, so it takes a few batches
+    Writer writer(fd, 256);
+    TradeSink<Encoding, Writer> sink(writer, batched);
+    for (const auto &oids : ids) {
+      sink(Trade(std::get<0>(oids), std::get<1>(oids), 4294967295u, 7));
+    }
+  }
+  ::close(fd);
+  MappedFile file(temp.m_path.c_str());
+  return std::string(file.data(), file.size());
+}
+
+} // namespace
+
+TEST(TradeSinkTests, Text) {
+  std::vector<std::tuple<uint32_t, uint32_t>> ids;
+  std::string expected;
+  for (uint32_t oid = 0; oid < 100; ++oid) {
+    ids.emplace_back(oid * 1000, oid);
+    std::ostringstream os;
+    os << "Trade " << Trade(oid * 1000, oid, 4294967295u, 7) << "\n";
+    expected += os.str();
+  }
+  ASSERT_EQ(expected, (sinkTrades<TextEncoding, FdWriter>(ids)));
+  ASSERT_EQ(expected, (sinkTrades<TextEncoding, FdWriter>(ids, false)));
+  ASSERT_EQ(expected, (sinkTrades<TextEncoding, ThreadedWriter>(ids)));
+  ASSERT_EQ("", (sinkTrades<TextEncoding, ThreadedWriter>({})));
+}
+
+TEST(TradeSinkTests, Binary) {
+  std::vector<std::tuple<uint32_t, uint32_t>> ids;
+  for (uint32_t oid = 0; oid < 100; ++oid) {
+    ids.emplace_back(oid * 1000, oid);
+  }
+  const std::string data(sinkTrades<BinaryEncoding, ThreadedWriter>(ids));
+  ASSERT_EQ(100 * 16u, data.size());
+  uint32_t fields[4];
+  memcpy(fields, data.data() + 16 * 99, sizeof(fields));
+  ASSERT_EQ(99000u, fields[0]);
+  ASSERT_EQ(99u, fields[1]);
+  ASSERT_EQ(4294967295u, fields[2]);
+  ASSERT_EQ(7u, fields[3]);
+}
+
+namespace {
+
+// a threaded writer only has the error once its thread is done
+void stopWriter(FdWriter &) {}
+void stopWriter(ThreadedWriter &writer) { writer.stop(); }
+
+// a write that fails doesn't throw out of the sink, it's kept for later
+template <typename Writer> void checkSinkError() {
+  // a read only descriptor can't be written to
+  TempFile temp("");
+  const int fd(::open(temp.m_path.c_str(), O_RDONLY));
+  Writer writer(fd, 256);
+  {
+    TradeSink<TextEncoding, Writer> sink(writer);
+    for (uint32_t oid = 0; oid < 100; ++oid) {
+      sink(Trade(oid, oid, 1, 7));
+    }
+  }
+  stopWriter(writer);
+  ASSERT_EQ(EBADF, writer.error());
+  ::close(fd);
+}
+
+} // namespace
+
+TEST(TradeSinkTests, Errors) {
+  checkSinkError<FdWriter>();
+  checkSinkError<ThreadedWriter>();
+}
+
 TEST(OrderBookTests, Basic) {
   OrderBook book;
   ASSERT_TRUE(std::isnan(book.getMidPrice()));
@@ -180,7 +994,7 @@ TEST(OrderBookTests, AddRemove) {
   // remove non existing order
   {
     RemoveActionT action(14, 12, 45.0);
-    ASSERT_THROW(book.handle(action, dummyCallback), UnknownOrderIdError);
+    ASSERT_EQ(Result::UnknownOrderId, book.handle(action, dummyCallback));
   }
 
   // nothing changed
@@ -225,7 +1039,7 @@ TEST(OrderBookTests, Modify) {
   {
     using WrongModifyAction = OrderAction<Action::Modify, Direction::Buy>;
     WrongModifyAction action(12, 34, 45.0);
-    ASSERT_THROW(book.handle(action, dummyCallback), UnknownOrderIdError);
+    ASSERT_EQ(Result::UnknownOrderId, book.handle(action, dummyCallback));
   }
 
   // so nothing changed
@@ -247,10 +1061,301 @@ TEST(OrderBookTests, Modify) {
   // and this is still wrong - we don't know this oid on the sell side
   {
     ModifyAction action(10, 34, 45.0);
-    ASSERT_THROW(book.handle(action, dummyCallback), UnknownOrderIdError);
+    ASSERT_EQ(Result::UnknownOrderId, book.handle(action, dummyCallback));
   }
 }
 
+// less volume at the same price is done in place, and keeps the order's place
+// in the queue. More volume, or another price, goes to the back.
+TEST(OrderBookTests, ModifyPriority) {
+  ArrayOrderBook book;
+  Processor<ArrayOrderBook> processor(book);
+  processor.process("A,1,B,10,100", dummyCallback);
+  processor.process("A,2,B,10,100", dummyCallback);
+  processor.process("A,3,B,10,100", dummyCallback);
+  auto queue = [&book] {
+    std::vector<std::pair<uint32_t, uint32_t>> orders;
+    for (const Order &order : book.getBuySide().front().second) {
+      orders.emplace_back(order.getOid(), order.getVolume());
+    }
+    return orders;
+  };
+  using QueueT = std::vector<std::pair<uint32_t, uint32_t>>;
+
+  processor.process("M,1,B,4,100", dummyCallback);
+  ASSERT_EQ(QueueT({{1, 4}, {2, 10}, {3, 10}}), queue());
+  ASSERT_EQ(24u, book.getBuySide().front().second.volume());
+  std::vector<LevelUpdate> updates;
+  book.forEachUpdate(
+      [&updates](const LevelUpdate &update) { updates.push_back(update); });
+  ASSERT_EQ(1u, updates.size());
+  ASSERT_EQ(24u, updates[0].volume);
+  ASSERT_EQ(3u, updates[0].orders);
+
+  // the same again changes nothing
+  processor.process("M,2,B,10,100", dummyCallback);
+  ASSERT_EQ(QueueT({{1, 4}, {2, 10}, {3, 10}}), queue());
+
+  processor.process("M,1,B,5,100", dummyCallback);
+  ASSERT_EQ(QueueT({{2, 10}, {3, 10}, {1, 5}}), queue());
+  processor.process("M,2,B,10,101", dummyCallback);
+  processor.process("M,2,B,10,100", dummyCallback);
+  ASSERT_EQ(QueueT({{3, 10}, {1, 5}, {2, 10}}), queue());
+  ASSERT_EQ(25u, book.getBuySide().front().second.volume());
+
+  // and whoever's first fills first
+  std::vector<uint32_t> filled;
+  auto cb = [&filled](const Trade &trade) {
+    filled.push_back(trade.getBuyOid());
+  };
+  processor.process("M,1,B,2,100", dummyCallback);
+  processor.process("A,4,S,12,100", cb);
+  ASSERT_EQ(std::vector<uint32_t>({3, 1}), filled);
+  ASSERT_EQ(QueueT({{2, 10}}), queue());
+}
+
+// an order modified to a price that crosses the book trades, same as an add
+TEST(OrderBookTests, ModifyCrosses) {
+  OrderBook book;
+  Processor<OrderBook> processor(book);
+  // buy oid, sell oid, volume, price
+  using TradeT = std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>;
+  std::vector<TradeT> trades;
+  auto cb = [&trades](const Trade &trade) {
+    trades.emplace_back(trade.getBuyOid(), trade.getSellOid(),
+                        trade.getVolume(), trade.getPrice());
+  };
+  processor.process("A,1,B,5,90", cb);
+  processor.process("A,2,S,3,100", cb);
+  processor.process("A,3,S,4,101", cb);
+  ASSERT_TRUE(trades.empty());
+
+  // at the resting orders' prices
+  ASSERT_EQ(Result::Ok, processor.process("M,1,B,8,101", cb));
+  ASSERT_EQ(std::vector<TradeT>({TradeT(1, 2, 3, 100), TradeT(1, 3, 4, 101)}),
+            trades);
+  ASSERT_TRUE(book.getSellSide().empty());
+  ASSERT_EQ(1u, book.getBuySide().front().second.volume());
+  ASSERT_EQ(101u, book.getIndex().find(1)->price);
+
+  // and the other way
+  trades.clear();
+  processor.process("A,4,S,2,105", cb);
+  processor.process("M,4,S,2,95", cb);
+  ASSERT_EQ(std::vector<TradeT>({TradeT(1, 4, 1, 101)}), trades);
+  ASSERT_TRUE(book.getBuySide().empty());
+  ASSERT_EQ(1u, book.getSellSide().front().second.volume());
+  ASSERT_EQ(95u, book.getSellSide().front().first);
+}
+
+// orders that never rest take what they can off the other side, and leave
+// their own side and the index alone
+template <typename BookT> void checkImmediates() {
+  BookT book;
+  Processor<BookT> processor(book);
+  using TradeT = std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>;
+  std::vector<TradeT> trades;
+  auto cb = [&trades](const Trade &trade) {
+    trades.emplace_back(trade.getBuyOid(), trade.getSellOid(),
+                        trade.getVolume(), trade.getPrice());
+  };
+  processor.process("A,1,S,5,100", cb);
+  processor.process("A,2,S,5,101", cb);
+  processor.process("A,3,S,5,103", cb);
+  processor.process("A,4,B,5,90", cb);
+  auto dump = [&book] {
+    std::ostringstream os;
+    os << book;
+    return os.str();
+  };
+  auto updates = [&book] {
+    std::size_t count(0);
+    book.forEachUpdate([&count](const LevelUpdate &) { ++count; });
+    return count;
+  };
+  const std::string before(dump());
+
+  // nothing at the price, so nothing happens at all
+  ASSERT_EQ(Result::Ok, processor.process("I,10,B,5,99", cb));
+  ASSERT_EQ(Result::Ok, processor.process("F,11,B,5,99", cb));
+  ASSERT_TRUE(trades.empty());
+  ASSERT_EQ(before, dump());
+  ASSERT_EQ(0u, updates());
+
+  // not enough at the price for all of it
+  ASSERT_EQ(Result::Ok, processor.process("F,12,B,11,102", cb));
+  ASSERT_TRUE(trades.empty());
+  ASSERT_EQ(before, dump());
+  ASSERT_EQ(0u, updates());
+
+  // a resting oid is turned down, whether it would trade or not
+  ASSERT_EQ(Result::DuplicateOrderId, processor.process("I,4,B,1,100", cb));
+  ASSERT_EQ(Result::DuplicateOrderId, processor.process("F,4,B,99,100", cb));
+  ASSERT_EQ(Result::DuplicateOrderId, processor.process("K,1,B,1", cb));
+  ASSERT_TRUE(trades.empty());
+  ASSERT_EQ(before, dump());
+
+  // as much as there is at the price, and the rest doesn't rest
+  ASSERT_EQ(Result::Ok, processor.process("I,13,B,12,101", cb));
+  ASSERT_EQ(std::vector<TradeT>({TradeT(13, 1, 5, 100), TradeT(13, 2, 5, 101)}),
+            trades);
+  ASSERT_EQ(103u, book.getSellSide().front().first);
+  ASSERT_EQ(90u, book.getBuySide().front().first);
+  ASSERT_EQ(1u, book.getBuySide().size());
+  ASSERT_EQ(2u, book.getIndex().size());
+  ASSERT_EQ(nullptr, book.getIndex().find(13));
+
+  // all of it when it's there
+  trades.clear();
+  processor.process("A,5,S,5,104", cb);
+  ASSERT_EQ(Result::Ok, processor.process("F,14,B,7,104", cb));
+  ASSERT_EQ(std::vector<TradeT>({TradeT(14, 3, 5, 103), TradeT(14, 5, 2, 104)}),
+            trades);
+  ASSERT_EQ(3u, book.getSellSide().front().second.volume());
+
+  // market orders go as far as they need to, and what's left is dropped
+  trades.clear();
+  processor.process("A,6,B,2,80", cb);
+  ASSERT_EQ(Result::Ok, processor.process("K,15,S,10", cb));
+  ASSERT_EQ(std::vector<TradeT>({TradeT(4, 15, 5, 90), TradeT(6, 15, 2, 80)}),
+            trades);
+  ASSERT_TRUE(book.getBuySide().empty());
+  ASSERT_EQ(1u, book.getSellSide().size());
+  trades.clear();
+  ASSERT_EQ(Result::Ok, processor.process("K,16,B,1", cb));
+  ASSERT_EQ(std::vector<TradeT>({TradeT(16, 5, 1, 104)}), trades);
+  ASSERT_EQ(1u, book.getIndex().size());
+
+  // and with nothing left, it's a no-op
+  trades.clear();
+  ASSERT_EQ(Result::Ok, processor.process("K,17,S,10", cb));
+  ASSERT_TRUE(trades.empty());
+}
+
+TEST(OrderBookTests, Immediates) {
+  checkImmediates<OrderBook>();
+  checkImmediates<ArrayOrderBook>();
+}
+
+TEST(OrderBookTests, Index) {
+  OrderBook book;
+
+  using BuyActionT = OrderAction<Action::Add, Direction::Buy>;
+  using SellActionT = OrderAction<Action::Add, Direction::Sell>;
+
+  {
+    BuyActionT action(12, 34, 45.0);
+    book.handle(action, dummyCallback);
+  }
+  {
+    SellActionT action(13, 10, 47.0);
+    book.handle(action, dummyCallback);
+  }
+  ASSERT_EQ(2u, book.getIndex().size());
+  ASSERT_EQ(Direction::Buy, book.getIndex().find(12)->dir);
+  ASSERT_EQ(45u, book.getIndex().find(12)->price);
+  ASSERT_EQ(Direction::Sell, book.getIndex().find(13)->dir);
+  ASSERT_EQ(nullptr, book.getIndex().find(14));
+
+  // the index follows the order when it's modified to another price
+  {
+    using ModifyActionT = OrderAction<Action::Modify, Direction::Buy>;
+    ModifyActionT action(12, 34, 44.0);
+    book.handle(action, dummyCallback);
+  }
+  ASSERT_EQ(44u, book.getIndex().find(12)->price);
+
+  // removing at the old price doesn't work any more
+  {
+    using RemoveActionT = OrderAction<Action::Remove, Direction::Buy>;
+    RemoveActionT action(12, 0, 45.0);
+    ASSERT_EQ(Result::UnknownOrderId, book.handle(action, dummyCallback));
+  }
+
+  // a partial fill keeps the order in the index, a full fill takes it out
+  {
+    SellActionT action(14, 30, 44.0);
+    book.handle(action, dummyCallback);
+  }
+  ASSERT_EQ(44u, book.getIndex().find(12)->price);
+  ASSERT_EQ(nullptr, book.getIndex().find(14));
+  {
+    SellActionT action(15, 10, 44.0);
+    book.handle(action, dummyCallback);
+  }
+  ASSERT_EQ(nullptr, book.getIndex().find(12));
+  ASSERT_EQ(44u, book.getIndex().find(15)->price);
+  ASSERT_EQ(2u, book.getIndex().size());
+}
+
+TEST(OrderBookTests, DuplicateOid) {
+  OrderBook book;
+
+  using BuyActionT = OrderAction<Action::Add, Direction::Buy>;
+  using SellActionT = OrderAction<Action::Add, Direction::Sell>;
+
+  {
+    BuyActionT action(12, 34, 45.0);
+    book.handle(action, dummyCallback);
+  }
+
+  // same oid, same price
+  {
+    BuyActionT action(12, 1, 45.0);
+    ASSERT_EQ(Result::DuplicateOrderId, book.handle(action, dummyCallback));
+  }
+  // same oid at another price
+  {
+    BuyActionT action(12, 1, 44.0);
+    ASSERT_EQ(Result::DuplicateOrderId, book.handle(action, dummyCallback));
+  }
+  // same oid on the other side
+  {
+    SellActionT action(12, 1, 50.0);
+    ASSERT_EQ(Result::DuplicateOrderId, book.handle(action, dummyCallback));
+  }
+
+  // none of that touched the book
+  ASSERT_EQ(1u, book.getBuySide().size());
+  ASSERT_EQ(1u, book.getBuySide().front().second.size());
+  ASSERT_EQ(34, book.getBuySide().front().second.front().getVolume());
+  ASSERT_TRUE(book.getSellSide().empty());
+
+  // once the order is gone, its oid can be used again
+  {
+    SellActionT action(13, 34, 45.0);
+    book.handle(action, dummyCallback);
+  }
+  {
+    SellActionT action(12, 1, 50.0);
+    book.handle(action, dummyCallback);
+  }
+  ASSERT_EQ(1u, book.getSellSide().size());
+}
+
+TEST(OrderBookTests, Depth) {
+  OrderBook book;
+  Processor<OrderBook> processor(book);
+  for (const char *line :
+       {"A,1,B,10,100", "A,2,B,5,100", "A,3,B,1,99", "A,4,B,7,98",
+        "A,5,S,3,101", "M,4,B,6,98", "A,6,S,12,100", "X,3,B,99"}) {
+    processor.process(line, dummyCallback);
+  }
+  // 100 is down to 3 of order 2, 99 is gone
+  LevelSummary levels[3];
+  ASSERT_EQ(2u, book.getBids(levels, 3));
+  ASSERT_EQ(100u, levels[0].price);
+  ASSERT_EQ(1u, levels[0].orders);
+  ASSERT_EQ(3u, levels[0].volume);
+  ASSERT_EQ(98u, levels[1].price);
+  ASSERT_EQ(6u, levels[1].volume);
+  ASSERT_EQ(1u, book.getBids(levels, 1));
+  ASSERT_EQ(0u, book.getBids(levels, 0));
+  ASSERT_EQ(1u, book.getAsks(levels, 3));
+  ASSERT_EQ(101u, levels[0].price);
+  ASSERT_EQ(3u, levels[0].volume);
+}
+
 TEST(OrderBookTests, MultipleOrdersSameLevel) {
   OrderBook book;
 
@@ -358,7 +1463,7 @@ TEST(OrderBookTests, CrossedBook) {
   {
     using ActionT = OrderAction<Action::Remove, Direction::Buy>;
     ActionT action(12, 3, 46.0);
-    ASSERT_THROW(book.handle(action, dummyCallback), UnknownOrderIdError);
+    ASSERT_EQ(Result::UnknownOrderId, book.handle(action, dummyCallback));
   }
 
   // next price ( 45.0 ) traded next, for 7 volume because that's all that's
@@ -397,6 +1502,944 @@ TEST(OrderBookTests, CrossedBook) {
   ASSERT_EQ(0u, book.getBuySide().size());
 }
 
+namespace {
+
+// replays a random flow of adds, modifies and removes through a book, and
+// keeps a record of everything that comes out of it
+template <typename BookT> struct RandomReplay {
+  RandomReplay(uint32_t numMessages, uint32_t seed) {
+    std::mt19937 rng(seed);
+    uint32_t mid(10000);
+    auto cb = [this](const Trade &trade) {
+      std::ostringstream os;
+      os << trade;
+      trades.push_back(os.str());
+    };
+
+    for (uint32_t n = 0; n < numMessages; ++n) {
+      // mostly a small random walk, but now and then the market jumps a long
+      // way, further than any window of ticks
+      mid += rng() % 1000 ? int(rng() % 21) - 10 : int(rng() % 20001) - 10000;
+      mid = std::max(mid, 10000u);
+
+      const uint32_t oid(rng() % 2000);
+      const uint32_t volume(1 + rng() % 10);
+      const uint32_t price(mid + rng() % 100 - 50);
+      const Direction dir(rng() % 2 ? Direction::Buy : Direction::Sell);
+      const uint32_t pick(rng() % 10);
+      const Action action(pick < 5   ? Action::Add
+                          : pick < 7 ? Action::Modify
+                                     : Action::Remove);
+      // removes go for the price the order is actually at, most of the time
+      const OrderLocation *location = book.getIndex().find(oid);
+      const uint32_t removePrice(location && rng() % 4 ? location->price
+                                                       : price);
+      const Result result(
+          Direction::Buy == dir
+              ? dispatch<Direction::Buy>(action, oid, volume, price,
+                                         removePrice, cb)
+              : dispatch<Direction::Sell>(action, oid, volume, price,
+                                          removePrice, cb));
+      if (Result::DuplicateOrderId == result) {
+        ++duplicates;
+      } else if (Result::UnknownOrderId == result) {
+        ++unknowns;
+      }
+      if (0 == n % 100) {
+        std::ostringstream os;
+        os << book;
+        dumps.push_back(os.str());
+        checkLevels(book.getBuySide());
+        checkLevels(book.getSellSide());
+      }
+    }
+  }
+
+  template <Direction dir, typename Callback>
+  Result dispatch(Action action, uint32_t oid, uint32_t volume,
+                  uint32_t price, uint32_t removePrice, Callback &cb) {
+    switch (action) {
+    case Action::Add: {
+      OrderAction<Action::Add, dir> oaction(oid, volume, price);
+      return book.handle(oaction, cb);
+    }
+    case Action::Modify: {
+      OrderAction<Action::Modify, dir> oaction(oid, volume, price);
+      return book.handle(oaction, cb);
+    }
+    default: {
+      OrderAction<Action::Remove, dir> oaction(oid, 0, removePrice);
+      return book.handle(oaction, cb);
+    }
+    }
+  }
+
+  // the running totals add up
+  template <typename SideT> void checkLevels(const SideT &side) {
+    side.forEach([](uint32_t, const Level &level) {
+      uint64_t volume(0);
+      std::size_t orders(0);
+      for (const Order &order : level) {
+        volume += order.getVolume();
+        ++orders;
+      }
+      ASSERT_EQ(volume, level.volume());
+      ASSERT_EQ(orders, level.size());
+    });
+  }
+
+  BookT book;
+  std::vector<std::string> trades;
+  std::vector<std::string> dumps;
+  uint32_t duplicates = 0;
+  uint32_t unknowns = 0;
+};
+
+} // namespace
+
+TEST(OrderBookTests, ArrayLadderMatchesMapLadder) {
+  // whatever the ladder, the book should behave exactly the same
+  for (uint32_t seed : {1, 2, 3}) {
+    RandomReplay<OrderBook> mapReplay(20000, seed);
+    RandomReplay<ArrayOrderBook> arrayReplay(20000, seed);
+    ASSERT_FALSE(mapReplay.trades.empty());
+    ASSERT_EQ(mapReplay.trades, arrayReplay.trades);
+    ASSERT_EQ(mapReplay.dumps, arrayReplay.dumps);
+    ASSERT_EQ(mapReplay.duplicates, arrayReplay.duplicates);
+    ASSERT_EQ(mapReplay.unknowns, arrayReplay.unknowns);
+  }
+}
+
+// every allocation through operator new gets counted while this is set, so
+// tests can check that a stretch of code doesn't allocate
+namespace {
+bool countAllocations(false);
+std::size_t allocations(0);
+} // namespace
+
+void *operator new(std::size_t size) {
+  if (countAllocations) {
+    ++allocations;
+  }
+  void *ptr(std::malloc(size ? size : 1));
+  if (nullptr == ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+// random text messages of all kinds: adds, modifies and removes, crossing
+// orders, duplicate and unknown oids, and the odd line that doesn't parse
+std::vector<std::string> randomFeed(uint32_t numMessages, uint32_t maxOid,
+                                    uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::string> lines;
+  uint32_t mid(10000);
+  for (uint32_t n = 0; n < numMessages; ++n) {
+    mid += rng() % 1000 ? int(rng() % 21) - 10 : int(rng() % 20001) - 10000;
+    mid = std::max(mid, 10000u);
+    const std::string oid(std::to_string(rng() % maxOid));
+    const std::string side(rng() % 2 ? "B" : "S");
+    const std::string volume(std::to_string(1 + rng() % 10));
+    const std::string price(std::to_string(mid + rng() % 100 - 50));
+    const uint32_t pick(rng() % 20);
+    if (0 == pick) {
+      lines.push_back("A," + oid + ",Q," + volume + "," + price);
+    } else if (pick < 10) {
+      lines.push_back("A," + oid + "," + side + "," + volume + "," + price);
+    } else if (pick < 15) {
+      lines.push_back("M," + oid + "," + side + "," + volume + "," + price +
+                      " // modify");
+    } else {
+      lines.push_back("X," + oid + "," + side + "," + price);
+    }
+  }
+  return lines;
+}
+
+// replays a feed through a book that's been given room for everything it's
+// going to hold, and counts the allocations once the book has warmed up
+template <typename BookT> void checkNoAllocations() {
+  const uint32_t maxOid(2048);
+  const auto lines(randomFeed(200000, maxOid, 42));
+
+  BookT book(maxOid, maxOid);
+  Processor<BookT> processor(book);
+  uint32_t trades(0);
+  uint32_t errors(0);
+  auto onTrade = [&trades](const Trade &) { ++trades; };
+  auto replay = [&](std::size_t from, std::size_t to) {
+    for (std::size_t n = from; n < to; ++n) {
+      try {
+        if (Result::Ok != processor.process(lines[n], onTrade)) {
+          ++errors;
+        }
+      } catch (const ParseError &) {
+        ++errors;
+      }
+    }
+  };
+
+  const std::size_t warmUp(lines.size() / 10);
+  replay(0, warmUp);
+  allocations = 0;
+  countAllocations = true;
+  replay(warmUp, lines.size());
+  countAllocations = false;
+
+  ASSERT_EQ(0u, allocations);
+  ASSERT_GT(trades, 0u);
+  ASSERT_GT(errors, 0u);
+}
+
+} // namespace
+
+TEST(OrderBookTests, NoAllocationsAfterWarmUp) {
+  checkNoAllocations<OrderBook>();
+  checkNoAllocations<ArrayOrderBook>();
+}
+
+namespace {
+
+// an add that's matched before it rests trades the same as one that rests
+// out of the way, then gets moved to its price and matched - the way modifies
+// still go
+template <typename BookT> void checkMatchBeforeRest() {
+  BookT direct;
+  BookT moved;
+  Processor<BookT> directProcessor(direct);
+  Processor<BookT> movedProcessor(moved);
+  std::vector<std::string> directTrades;
+  std::vector<std::string> movedTrades;
+  auto record = [](std::vector<std::string> &trades) {
+    return [&trades](const Trade &trade) {
+      std::ostringstream os;
+      os << trade;
+      trades.push_back(os.str());
+    };
+  };
+  auto directCb = record(directTrades);
+  auto movedCb = record(movedTrades);
+
+  for (const std::string &line : randomFeed(50000, 2048, 42)) {
+    Message message;
+    try {
+      message = parseMessage(line.data(), line.size());
+    } catch (const ParseError &) {
+      continue;
+    }
+    const Result result(directProcessor.process(message, directCb));
+    if (Action::Add != message.action) {
+      ASSERT_EQ(result, movedProcessor.process(message, movedCb)) << line;
+      continue;
+    }
+    Message away(message);
+    away.price = Direction::Buy == message.dir ? 1 : 1000000;
+    ASSERT_EQ(result, movedProcessor.process(away, movedCb)) << line;
+    if (Result::Ok == result) {
+      message.action = Action::Modify;
+      ASSERT_EQ(Result::Ok, movedProcessor.process(message, movedCb)) << line;
+    }
+  }
+  ASSERT_GT(directTrades.size(), 1000u);
+  ASSERT_EQ(directTrades, movedTrades);
+  std::ostringstream directBook, movedBook;
+  directBook << direct;
+  movedBook << moved;
+  ASSERT_EQ(directBook.str(), movedBook.str());
+  ASSERT_EQ(direct.getIndex().size(), moved.getIndex().size());
+}
+
+} // namespace
+
+TEST(OrderBookTests, MatchBeforeRest) {
+  checkMatchBeforeRest<OrderBook>();
+  checkMatchBeforeRest<ArrayOrderBook>();
+}
+
+TEST(OrderBookTests, AllocationCounting) {
+  // make sure the counting itself works
+  allocations = 0;
+  countAllocations = true;
+  std::unique_ptr<int> ptr(new int(42));
+  countAllocations = false;
+  ASSERT_EQ(1u, allocations);
+}
+
+TEST(SpscRingTests, Basic) {
+  SpscRing<uint32_t> ring(3);
+  ASSERT_EQ(4u, ring.capacity());
+  uint32_t value;
+  ASSERT_FALSE(ring.pop(value));
+  for (uint32_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring.push(i));
+  }
+  ASSERT_FALSE(ring.push(4));
+  ASSERT_TRUE(ring.pop(value));
+  ASSERT_EQ(0u, value);
+  ASSERT_TRUE(ring.push(4));
+  for (uint32_t i = 1; i < 5; ++i) {
+    ASSERT_TRUE(ring.pop(value));
+    ASSERT_EQ(i, value);
+  }
+  ASSERT_FALSE(ring.pop(value));
+}
+
+TEST(SpscRingTests, Threads) {
+  const uint32_t count(1000000);
+  SpscRing<uint32_t> ring(64);
+  std::thread producer([&ring] {
+    for (uint32_t i = 0; i < count; ++i) {
+      while (!ring.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t value;
+  for (uint32_t i = 0; i < count; ++i) {
+    while (!ring.pop(value)) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(i, value);
+  }
+  producer.join();
+}
+
+// a feed over several symbols ends up the same whether it's spread over
+// threads or not
+TEST(ShardedEngineTests, MatchesSingleThread) {
+  const uint16_t symbols(7);
+  std::mt19937 rng(7);
+  std::vector<Message> messages;
+  for (const std::string &line : randomFeed(100000, 2048, 42)) {
+    const std::string prefixed(std::to_string(rng() % symbols) + "," + line);
+    try {
+      messages.push_back(parseMessage(prefixed.data(), prefixed.size()));
+    } catch (const ParseError &) {
+      // those never make it to an engine
+    }
+  }
+
+  uint64_t trades(0);
+  auto count = [&trades](const Trade &) { ++trades; };
+  BookManager<OrderBook> books(symbols);
+  Processor<BookManager<OrderBook>> processor(books);
+  ShardStats expected;
+  for (const Message &message : messages) {
+    ++expected.messages;
+    switch (processor.process(message, count)) {
+    case Result::Ok:
+      break;
+    case Result::DuplicateOrderId:
+      ++expected.duplicateOrderIdErrors;
+      break;
+    case Result::UnknownOrderId:
+      ++expected.unknownOrderIdErrors;
+      break;
+    default:
+      ++expected.parseErrors;
+      break;
+    }
+  }
+
+  std::atomic<uint64_t> shardedTrades(0);
+  auto shardedCount = [&shardedTrades](const Trade &) { ++shardedTrades; };
+  ShardedEngine<OrderBook, decltype(shardedCount)> engine(3, shardedCount,
+                                                          16);
+  for (const Message &message : messages) {
+    engine.submit(message);
+  }
+  engine.stop();
+
+  ASSERT_EQ(trades, shardedTrades.load());
+  const ShardStats stats(engine.stats());
+  ASSERT_EQ(expected.messages, stats.messages);
+  ASSERT_EQ(trades, stats.trades);
+  ASSERT_EQ(expected.duplicateOrderIdErrors, stats.duplicateOrderIdErrors);
+  ASSERT_EQ(expected.unknownOrderIdErrors, stats.unknownOrderIdErrors);
+  ASSERT_EQ(expected.parseErrors, stats.parseErrors);
+  for (uint16_t symbol = 0; symbol < symbols; ++symbol) {
+    const OrderBook *book(engine.books(symbol % 3).find(symbol));
+    ASSERT_NE(nullptr, book);
+    ASSERT_EQ(books[symbol].getIndex().size(), book->getIndex().size());
+    std::ostringstream expectedBook, shardedBook;
+    expectedBook << books[symbol];
+    shardedBook << *book;
+    ASSERT_EQ(expectedBook.str(), shardedBook.str());
+  }
+
+  // with a callback for each shard, the trades are split between them
+  uint64_t perShard[3] = {0, 0, 0};
+  auto countFor = [&perShard](std::size_t shard) {
+    return [&perShard, shard](const Trade &) { ++perShard[shard]; };
+  };
+  std::vector<decltype(countFor(0))> callbacks;
+  for (std::size_t shard = 0; shard < 3; ++shard) {
+    callbacks.push_back(countFor(shard));
+  }
+  ShardedEngine<OrderBook, decltype(countFor(0))> split(callbacks, 16);
+  for (const Message &message : messages) {
+    split.submit(message);
+  }
+  split.stop();
+  ASSERT_EQ(trades, perShard[0] + perShard[1] + perShard[2]);
+  ASSERT_LT(0u, perShard[0]);
+  ASSERT_LT(0u, perShard[1]);
+  ASSERT_LT(0u, perShard[2]);
+}
+
+TEST(LevelChangesTests, Coalesced) {
+  OrderBook book;
+  Processor<OrderBook> processor(book);
+  auto updates = [&book] {
+    std::vector<std::tuple<Direction, uint32_t, uint32_t, uint64_t>> updates;
+    book.forEachUpdate([&updates](const LevelUpdate &update) {
+      updates.emplace_back(update.dir, update.price, update.orders,
+                           update.volume);
+    });
+    return updates;
+  };
+  using UpdateT = std::tuple<Direction, uint32_t, uint32_t, uint64_t>;
+
+  processor.process("A,1,B,10,100", dummyCallback);
+  processor.process("A,2,B,5,100", dummyCallback);
+  ASSERT_EQ(std::vector<UpdateT>({UpdateT(Direction::Buy, 100, 2, 15)}),
+            updates());
+  processor.process("A,3,B,1,99", dummyCallback);
+  processor.process("M,3,B,1,100", dummyCallback);
+  ASSERT_EQ(std::vector<UpdateT>({UpdateT(Direction::Buy, 99, 0, 0),
+                                  UpdateT(Direction::Buy, 100, 3, 16)}),
+            updates());
+
+  // the sell order trades away before it ever rests, so its own level
+  // doesn't change. Each fill touches the bids - but the level comes out
+  // once, as it ends up.
+  processor.process("A,4,S,12,100", dummyCallback);
+  ASSERT_EQ(std::vector<UpdateT>({UpdateT(Direction::Buy, 100, 2, 4)}),
+            updates());
+
+  // nothing changed
+  ASSERT_EQ(Result::UnknownOrderId,
+            processor.process("X,4,S,100", dummyCallback));
+  ASSERT_TRUE(updates().empty());
+
+  // what's left of one after it's traded rests
+  processor.process("A,5,S,6,100", dummyCallback);
+  ASSERT_EQ(std::vector<UpdateT>({UpdateT(Direction::Buy, 100, 0, 0),
+                                  UpdateT(Direction::Sell, 100, 1, 2)}),
+            updates());
+}
+
+// keeping a copy of the levels up to date from nothing but the updates ends
+// up with the book's levels, every step of the way
+TEST(LevelChangesTests, Mirror) {
+  ArrayOrderBook book;
+  Processor<ArrayOrderBook> processor(book);
+  std::map<std::pair<Direction, uint32_t>, std::pair<uint32_t, uint64_t>>
+      mirror;
+  for (const std::string &line : randomFeed(20000, 512, 42)) {
+    try {
+      processor.process(line, dummyCallback);
+    } catch (const OrderBookError &) {
+    }
+    book.forEachUpdate([&mirror](const LevelUpdate &update) {
+      if (0u == update.orders) {
+        ASSERT_EQ(0u, update.volume);
+        mirror.erase(std::make_pair(update.dir, update.price));
+      } else {
+        mirror[std::make_pair(update.dir, update.price)] =
+            std::make_pair(update.orders, update.volume);
+      }
+    });
+
+    std::map<std::pair<Direction, uint32_t>, std::pair<uint32_t, uint64_t>>
+        levels;
+    auto add = [&levels](Direction dir) {
+      return [&levels, dir](uint32_t price, const Level &level) {
+        levels[std::make_pair(dir, price)] = std::make_pair(
+            static_cast<uint32_t>(level.size()), level.volume());
+      };
+    };
+    book.getBuySide().forEach(add(Direction::Buy));
+    book.getSellSide().forEach(add(Direction::Sell));
+    ASSERT_EQ(levels, mirror) << line;
+  }
+}
+
+namespace {
+
+// a book per symbol that goes through the feed, with whatever it prints and
+// trades kept as it goes
+struct StateReplay {
+  explicit StateReplay(std::vector<std::string> *trades)
+      : processor(books), cb([trades](const Trade &trade) {
+          std::ostringstream os;
+          os << trade;
+          trades->push_back(os.str());
+        }) {}
+
+  void process(const std::vector<std::string> &lines, std::size_t from,
+               std::size_t to) {
+    for (std::size_t n = from; n < to; ++n) {
+      try {
+        processor.process(lines[n], cb);
+      } catch (const OrderBookError &) {
+      }
+    }
+  }
+
+  std::string dump() const {
+    std::ostringstream os;
+    books.forEach([&os](uint16_t symbol, const OrderBook &book) {
+      os << symbol << book;
+    });
+    return os.str();
+  }
+
+  BookManager<OrderBook> books;
+  Processor<BookManager<OrderBook>> processor;
+  std::function<void(const Trade &)> cb;
+};
+
+} // namespace
+
+// picking up from a saved state goes on exactly like the books that were
+// saved, queue positions and all
+TEST(BookStateTests, RoundTrip) {
+  std::vector<std::string> lines;
+  uint32_t n(0);
+  for (const std::string &line : randomFeed(40000, 1024, 7)) {
+    lines.push_back(std::to_string(n++ % 3) + "," + line);
+  }
+
+  std::vector<std::string> trades;
+  StateReplay original(&trades);
+  original.process(lines, 0, 20000);
+  std::ostringstream os;
+  writeState(os, original.books, 20000);
+  const std::string data(os.str());
+  ASSERT_TRUE(BookState::matches(data.data(), data.size()));
+
+  const BookState state(data.data(), data.size());
+  ASSERT_EQ(20000u, state.offset());
+  std::size_t orders(0);
+  original.books.forEach([&orders](uint16_t, const OrderBook &book) {
+    orders += book.getIndex().size();
+  });
+  ASSERT_LT(0u, orders);
+  ASSERT_EQ(orders, state.size());
+
+  std::vector<std::string> restoredTrades;
+  StateReplay restored(&restoredTrades);
+  ASSERT_EQ(20000u, restoreState(restored.books, state));
+  ASSERT_EQ(original.dump(), restored.dump());
+
+  const std::size_t before(trades.size());
+  original.process(lines, 20000, lines.size());
+  restored.process(lines, 20000, lines.size());
+  ASSERT_LT(before, trades.size());
+  ASSERT_EQ(std::vector<std::string>(trades.begin() + before, trades.end()),
+            restoredTrades);
+  ASSERT_EQ(original.dump(), restored.dump());
+}
+
+TEST(BookStateTests, Errors) {
+  OrderBook book;
+  Processor<OrderBook> processor(book);
+  processor.process("A,1,B,10,100", dummyCallback);
+  processor.process("A,2,S,10,101", dummyCallback);
+  std::ostringstream os;
+  writeState(os, book, 2);
+  const std::string data(os.str());
+  ASSERT_EQ(sizeof(StateHeader) + 2 * sizeof(Record), data.size());
+
+  // a binary feed isn't a state, and the other way round
+  std::ostringstream feed;
+  writeFeedHeader(feed);
+  ASSERT_FALSE(BookState::matches(feed.str().data(), feed.str().size()));
+  ASSERT_FALSE(BinaryFeed::matches(data.data(), data.size()));
+  ASSERT_THROW(BookState(data.data(), data.size() - sizeof(Record)),
+               ParseError);
+  std::string newer(data);
+  newer[sizeof(StateHeader::magic)] = 2;
+  ASSERT_THROW(BookState(newer.data(), newer.size()), ParseError);
+
+  // the orders are still resting
+  OrderBook again;
+  const BookState state(data.data(), data.size());
+  restoreState(again, state);
+  ASSERT_THROW(restoreState(again, state), DuplicateOrderIdError);
+
+  // only symbol 0 for a book on its own, and only adds
+  std::string other(data);
+  other[sizeof(StateHeader) + offsetof(Record, symbol)] = 1;
+  OrderBook single;
+  ASSERT_THROW(restoreState(single, BookState(other.data(), other.size())),
+               UnknownSymbolError);
+  std::string removes(data);
+  removes[sizeof(StateHeader)] = 'X';
+  OrderBook fresh;
+  ASSERT_THROW(
+      restoreState(fresh, BookState(removes.data(), removes.size())),
+      ParseError);
+
+  // a state that can't be saved says why
+  try {
+    saveState("/nonexistent/books.state", book, 2);
+    FAIL();
+  } catch (const std::system_error &e) {
+    ASSERT_EQ(ENOENT, e.code().value());
+  }
+}
+
+// everything appended gets written, in order, however it gets grouped
+TEST(JournalTests, RoundTrip) {
+  TempFile temp("");
+  const int fd(::open(temp.m_path.c_str(), O_WRONLY | O_APPEND));
+  ASSERT_LE(0, fd);
+  {
+    // a ring smaller than what goes through it, so appending has to wait
+    Journal journal(fd, Durability::Sync, 64, 16);
+    for (uint32_t sequence = 1; sequence <= 1000; ++sequence) {
+      journal.message(sequence, Message{Action::Add, Direction::Buy, sequence,
+                                        10, 100, 7});
+      if (0u == sequence % 10) {
+        journal.trade(sequence, 7, Trade(sequence, 1, 5, 100));
+      }
+    }
+    journal.stop();
+    ASSERT_EQ(0, journal.error());
+    ASSERT_EQ(1000u, journal.committed());
+    ASSERT_LT(0u, journal.groups());
+  }
+  {
+    MappedFile file(temp.m_path.c_str());
+    const JournalReader journal(file.data(), file.size());
+    ASSERT_EQ(1100u, journal.size());
+    ASSERT_EQ(0u, journal.torn());
+    uint64_t sequence(0);
+    for (const JournalEntry &entry : journal) {
+      if (tradeEntry == entry.record.action) {
+        ASSERT_EQ(sequence, entry.sequence);
+        ASSERT_EQ(0u, sequence % 10);
+        const Trade trade(toTrade(entry));
+        ASSERT_EQ(sequence, trade.getBuyOid());
+        ASSERT_EQ(1u, trade.getSellOid());
+        ASSERT_EQ(5u, trade.getVolume());
+        ASSERT_EQ(100u, trade.getPrice());
+      } else {
+        ASSERT_EQ(++sequence, entry.sequence);
+        std::ostringstream os;
+        os << toMessage(entry.record);
+        ASSERT_EQ("7,A," + std::to_string(sequence) + ",B,10,100", os.str());
+      }
+    }
+    ASSERT_EQ(1000u, sequence);
+  }
+
+  // half an entry at the end, as if we'd gone down writing it
+  ASSERT_EQ(5, ::write(fd, "AAAAA", 5));
+  {
+    MappedFile file(temp.m_path.c_str());
+    const JournalReader journal(file.data(), file.size());
+    ASSERT_EQ(1100u, journal.size());
+    ASSERT_EQ(5u, journal.torn());
+  }
+  // which goes when the journal is picked up again
+  {
+    Journal journal(fd);
+    journal.message(1001, Message{Action::Remove, Direction::Sell, 1, 0, 100,
+                                  0});
+  }
+  {
+    MappedFile file(temp.m_path.c_str());
+    const JournalReader journal(file.data(), file.size());
+    ASSERT_EQ(1101u, journal.size());
+    ASSERT_EQ(0u, journal.torn());
+    ASSERT_EQ(1001u, (journal.end() - 1)->sequence);
+  }
+  ::close(fd);
+
+  ASSERT_THROW(JournalReader("OBFEED\0\0\1\0\0\0\0\0\0\0", 16),
+               ParseError);
+}
+
+// appending that can't get into the ring in time fails the journal, and
+// what was written before that has no gaps in it
+TEST(JournalTests, Stalls) {
+  TempFile temp("");
+  const int fd(::open(temp.m_path.c_str(), O_WRONLY | O_APPEND));
+  ASSERT_LE(0, fd);
+  {
+    // syncing every few entries, it can't keep up with no wait at all
+    Journal journal(fd, Durability::Sync, 64, 16, std::chrono::milliseconds(0));
+    for (uint32_t sequence = 1; sequence <= 100000; ++sequence) {
+      journal.message(sequence, Message{Action::Add, Direction::Buy, sequence,
+                                        10, 100, 7});
+    }
+    journal.stop();
+    ASSERT_EQ(ETIMEDOUT, journal.error());
+    ASSERT_LT(0u, journal.stalls());
+    ASSERT_GT(100000u, journal.committed());
+  }
+  MappedFile file(temp.m_path.c_str());
+  const JournalReader journal(file.data(), file.size());
+  ASSERT_GT(100000u, journal.size());
+  uint64_t sequence(0);
+  for (const JournalEntry &entry : journal) {
+    ASSERT_EQ(++sequence, entry.sequence);
+  }
+  ::close(fd);
+}
+
+// the cancels and modifies go for orders that are resting, so nothing gets
+// thrown out - and the same seed is the same flow
+TEST(WorkloadTests, Flow) {
+  WorkloadOptions options;
+  options.symbols = 8;
+  options.resting = 500;
+  options.bursts = 0.01;
+  options.aggressive = 0.05;
+  options.immediates = 0.5;
+  Workload workload(options);
+  Workload again(options);
+  BookManager<OrderBook> books;
+  Processor<BookManager<OrderBook>> processor(books);
+  std::vector<uint32_t> perSymbol(options.symbols);
+  std::map<Action, uint32_t> actions;
+  uint32_t trades(0);
+  auto cb = [&trades](const Trade &) { ++trades; };
+  for (uint32_t n = 0; n < 100000; ++n) {
+    const Message message(workload.next());
+    const Message same(again.next());
+    ASSERT_EQ(std::make_tuple(message.action, message.dir, message.oid,
+                              message.volume, message.price, message.symbol),
+              std::make_tuple(same.action, same.dir, same.oid, same.volume,
+                              same.price, same.symbol));
+    ASSERT_EQ(Result::Ok, processor.process(message, cb)) << message;
+    // and as text
+    std::ostringstream line;
+    line << message;
+    const Message parsed(parseMessage(line.str().data(), line.str().size()));
+    ASSERT_EQ(std::make_tuple(message.action, message.dir, message.oid,
+                              message.volume, message.price, message.symbol),
+              std::make_tuple(parsed.action, parsed.dir, parsed.oid,
+                              parsed.volume, parsed.price, parsed.symbol))
+        << line.str();
+    ++perSymbol[message.symbol];
+    ++actions[message.action];
+  }
+  // busier symbols first, but they all get some
+  ASSERT_GT(perSymbol[0], perSymbol[7] * 4);
+  ASSERT_LT(0u, perSymbol[7]);
+  ASSERT_LT(0u, trades);
+  ASSERT_LT(actions[Action::Modify], actions[Action::Remove]);
+  ASSERT_LT(actions[Action::Remove], actions[Action::Add]);
+  ASSERT_LT(0u, actions[Action::Ioc]);
+  ASSERT_LT(0u, actions[Action::Fok]);
+  ASSERT_LT(0u, actions[Action::Market]);
+
+  // the books it kept come out the same as ours
+  books.forEach(
+      [&workload, &options](uint16_t symbol, const OrderBook &book) {
+        std::ostringstream ours;
+        std::ostringstream its;
+        ours << book;
+        its << *workload.books().find(symbol);
+        ASSERT_EQ(ours.str(), its.str());
+        ASSERT_GE(options.resting + options.burst, book.getIndex().size());
+      });
+}
+
+TEST(WorkloadTests, GenR) {
+  GenRWorkload workload;
+  for (uint32_t pair = 0; pair < 1000; ++pair) {
+    const Message bid(workload.next());
+    const Message ask(workload.next());
+    const Message bidMoved(workload.next());
+    const Message askMoved(workload.next());
+    ASSERT_EQ(Action::Add, bid.action);
+    ASSERT_EQ(pair * 2, bid.oid);
+    ASSERT_TRUE(bid.price >= 10 && bid.price <= 100);
+    ASSERT_EQ(pair * 2 + 1, ask.oid);
+    ASSERT_TRUE(ask.price >= 600 && ask.price <= 2000);
+    ASSERT_EQ(Action::Modify, bidMoved.action);
+    ASSERT_EQ(bid.volume, bidMoved.volume);
+    ASSERT_TRUE(bidMoved.price >= 100 && bidMoved.price <= 500);
+    ASSERT_EQ(Direction::Sell, askMoved.dir);
+    ASSERT_TRUE(askMoved.price >= 100 && askMoved.price <= 480);
+  }
+}
+
+// every value is reported as no more than about 3% over what it was
+TEST(LatencyTests, Histogram) {
+  LatencyHistogram histogram;
+  ASSERT_EQ(0u, histogram.percentile(0.5));
+  for (uint64_t value = 1; value <= 100000; ++value) {
+    histogram.record(value);
+  }
+  ASSERT_EQ(100000u, histogram.count());
+  ASSERT_EQ(100000u, histogram.max());
+  for (double p : {0.001, 0.5, 0.9, 0.99, 0.999}) {
+    const double exact(p * 100000);
+    ASSERT_GE(histogram.percentile(p), exact) << p;
+    ASSERT_LE(histogram.percentile(p), exact * 1.035) << p;
+  }
+  ASSERT_EQ(100000u, histogram.percentile(1.0));
+
+  // small values are exact, huge ones still fit
+  LatencyHistogram small;
+  small.record(3);
+  small.record(~uint64_t(0));
+  ASSERT_EQ(3u, small.percentile(0.5));
+  ASSERT_EQ(~uint64_t(0), small.percentile(1.0));
+
+  histogram.add(small);
+  ASSERT_EQ(100002u, histogram.count());
+  histogram.clear();
+  ASSERT_EQ(0u, histogram.count());
+  ASSERT_EQ(0u, histogram.max());
+}
+
+TEST(LatencyTests, Shapes) {
+  ASSERT_EQ(MessageShape::Add, shapeOf(Action::Add, 0));
+  ASSERT_EQ(MessageShape::AddTrades, shapeOf(Action::Add, sweepTrades));
+  ASSERT_EQ(MessageShape::AddSweeps, shapeOf(Action::Add, sweepTrades + 1));
+  ASSERT_EQ(MessageShape::Modify, shapeOf(Action::Modify, 0));
+  ASSERT_EQ(MessageShape::Remove, shapeOf(Action::Remove, 0));
+  ASSERT_EQ(MessageShape::Immediate, shapeOf(Action::Ioc, 3));
+  ASSERT_EQ(MessageShape::Immediate, shapeOf(Action::Market, 0));
+
+  std::ostringstream os;
+  {
+    MessageLatencies latencies(os, 3);
+    for (int n = 0; n < 4; ++n) {
+      latencies.stop(latencies.start(), MessageShape::Modify);
+    }
+    latencies.stop(latencies.start(), MessageShape::Rejected);
+    ASSERT_NE(std::string::npos, os.str().find("ns, last 3"));
+    latencies.report();
+    ASSERT_EQ(4u, latencies.total(MessageShape::Modify).count());
+    ASSERT_EQ(1u, latencies.total(MessageShape::Rejected).count());
+  }
+  ASSERT_NE(std::string::npos, os.str().find("ns, all"));
+  ASSERT_NE(std::string::npos, os.str().find("rejected"));
+  ASSERT_EQ(std::string::npos, os.str().find("remove"));
+}
+
+// a reader never sees half of one store and half of another
+TEST(SeqlockTests, NoTornReads) {
+  struct Words {
+    uint64_t words[32];
+  };
+  Seqlock<Words> seqlock;
+  ASSERT_EQ(0u, seqlock.version());
+  ASSERT_EQ(0u, seqlock.load().words[31]);
+
+  const uint64_t stores(200000);
+  std::thread writer([&seqlock] {
+    Words value;
+    for (uint64_t i = 1; i <= stores; ++i) {
+      std::fill(std::begin(value.words), std::end(value.words), i);
+      seqlock.store(value);
+    }
+  });
+  uint64_t last(0);
+  while (last != stores) {
+    const Words value(seqlock.load());
+    for (uint64_t word : value.words) {
+      ASSERT_EQ(value.words[0], word);
+    }
+    ASSERT_LE(last, value.words[0]);
+    last = value.words[0];
+  }
+  writer.join();
+  ASSERT_EQ(stores, seqlock.version());
+}
+
+TEST(SnapshotTests, Levels) {
+  PublishedBook<OrderBook, 2> book;
+  ASSERT_EQ(0u, book.snapshot().updates);
+  ASSERT_EQ(0u, book.snapshot().bidLevels);
+
+  Processor<PublishedBook<OrderBook, 2>> processor(book);
+  for (const char *line : {"A,1,B,10,100", "A,2,B,5,100", "A,3,B,1,99",
+                           "A,4,B,1,98", "A,5,S,3,101"}) {
+    processor.process(line, dummyCallback);
+  }
+  auto snapshot(book.snapshot());
+  ASSERT_EQ(5u, snapshot.updates);
+  ASSERT_EQ(2u, snapshot.bidLevels);
+  ASSERT_EQ(100u, snapshot.bids[0].price);
+  ASSERT_EQ(2u, snapshot.bids[0].orders);
+  ASSERT_EQ(15u, snapshot.bids[0].volume);
+  ASSERT_EQ(99u, snapshot.bids[1].price);
+  ASSERT_EQ(1u, snapshot.asks[0].orders);
+  ASSERT_EQ(1u, snapshot.askLevels);
+
+  // rejected messages don't count
+  ASSERT_EQ(Result::UnknownOrderId,
+            processor.process("X,9,B,100", dummyCallback));
+  // takes out the level at 100, and what's left rests there
+  processor.process("A,6,S,17,100", dummyCallback);
+  snapshot = book.snapshot();
+  ASSERT_EQ(6u, snapshot.updates);
+  ASSERT_EQ(2u, snapshot.bidLevels);
+  ASSERT_EQ(99u, snapshot.bids[0].price);
+  ASSERT_EQ(98u, snapshot.bids[1].price);
+  ASSERT_EQ(2u, snapshot.askLevels);
+  ASSERT_EQ(100u, snapshot.asks[0].price);
+  ASSERT_EQ(2u, snapshot.asks[0].volume);
+  ASSERT_EQ(101u, snapshot.asks[1].price);
+  ASSERT_EQ(3u, snapshot.asks[1].volume);
+}
+
+// snapshots read while the book is busy are all consistent, and the last one
+// is the book as it ends up
+TEST(SnapshotTests, Readers) {
+  using BookT = PublishedBook<ArrayOrderBook, 5>;
+  BookT book;
+  std::atomic<bool> done(false);
+  auto read = [&book, &done] {
+    uint64_t updates(0);
+    while (!done.load()) {
+      const BookT::SnapshotT snapshot(book.snapshot());
+      EXPECT_LE(updates, snapshot.updates);
+      updates = snapshot.updates;
+      for (uint32_t i = 1; i < snapshot.bidLevels; ++i) {
+        EXPECT_GT(snapshot.bids[i - 1].price, snapshot.bids[i].price);
+      }
+      for (uint32_t i = 1; i < snapshot.askLevels; ++i) {
+        EXPECT_LT(snapshot.asks[i - 1].price, snapshot.asks[i].price);
+      }
+    }
+  };
+  std::thread first(read), second(read);
+
+  Processor<BookT> processor(book);
+  for (const std::string &line : randomFeed(50000, 2048, 42)) {
+    try {
+      processor.process(line, dummyCallback);
+    } catch (const OrderBookError &) {
+    }
+  }
+  done = true;
+  first.join();
+  second.join();
+
+  BookT::SnapshotT expected;
+  takeSnapshot(book, book.snapshot().updates, expected);
+  const BookT::SnapshotT snapshot(book.snapshot());
+  ASSERT_EQ(0, memcmp(&expected, &snapshot, sizeof(snapshot)));
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
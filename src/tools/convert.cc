@@ -0,0 +1,59 @@
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <system_error>
+
+#include "../BinaryFeed.h"
+#include "../Exceptions.h"
+#include "../MappedFile.h"
+#include "../Parser.h"
+
+// turns a text input file ( test-input.txt, or what generate writes ) into a
+// binary feed main can replay without parsing. Lines that don't parse are
+// left out.
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " input-file output-file" << std::endl;
+    return 1;
+  }
+  std::unique_ptr<mvs::orderbook::MappedFile> mapped;
+  try {
+    mapped.reset(new mvs::orderbook::MappedFile(argv[1]));
+  } catch (const std::system_error &e) {
+    std::cerr << "can't read " << argv[1] << ": " << e.code().message()
+              << std::endl;
+    return 1;
+  }
+  mvs::orderbook::MappedFile &input(*mapped);
+  std::ofstream output(argv[2], std::ios::binary | std::ios::trunc);
+  if (!output) {
+    std::cerr << "can't write " << argv[2] << std::endl;
+    return 1;
+  }
+
+  uint32_t numRecords(0);
+  uint32_t parseErrors(0);
+
+  mvs::orderbook::writeFeedHeader(output);
+  const char *line;
+  std::size_t length;
+  while (input.getline(line, length)) {
+    try {
+      mvs::orderbook::writeRecord(
+          output, mvs::orderbook::toRecord(
+                      mvs::orderbook::parseMessage(line, length)));
+      numRecords++;
+    } catch (const mvs::orderbook::ParseError &e) {
+      std::cerr << e.what() << std::endl;
+      parseErrors++;
+    }
+  }
+
+  output.close();
+  if (!output) {
+    std::cerr << "failed writing " << argv[2] << std::endl;
+    return 1;
+  }
+  std::cout << numRecords << " records" << std::endl;
+  std::cout << parseErrors << " parse errors" << std::endl;
+}
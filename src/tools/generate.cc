@@ -0,0 +1,178 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "../BinaryFeed.h"
+#include "../Parser.h"
+#include "../TradeSink.h"
+#include "../Workload.h"
+
+namespace {
+
+// a message as a line of text, with the symbol in front if there's more than
+// one. Room for the longest one there can be.
+constexpr std::size_t maxLine = 64;
+
+std::size_t formatLine(const mvs::orderbook::Message &message, bool symbol,
+                       char *out) {
+  using mvs::orderbook::details::formatDecimal;
+  char *pos(out);
+  if (symbol) {
+    pos += formatDecimal(message.symbol, pos);
+    *pos++ = ',';
+  }
+  *pos++ = static_cast<char>(message.action);
+  *pos++ = ',';
+  pos += formatDecimal(message.oid, pos);
+  *pos++ = ',';
+  *pos++ = static_cast<char>(message.dir);
+  *pos++ = ',';
+  if (mvs::orderbook::Action::Remove != message.action) {
+    pos += formatDecimal(message.volume, pos);
+    if (mvs::orderbook::Action::Market == message.action) {
+      *pos++ = '\n';
+      return pos - out;
+    }
+    *pos++ = ',';
+  }
+  pos += formatDecimal(message.price, pos);
+  *pos++ = '\n';
+  return pos - out;
+}
+
+// writes count messages out of the workload, a batch at a time. Returns the
+// errno of a write that failed, 0 if they all went out.
+template <typename WorkloadT>
+int generate(WorkloadT &workload, uint64_t count, bool binary, bool symbol,
+              int fd) {
+  mvs::orderbook::FdWriter writer(fd);
+  char *begin(writer.acquire());
+  char *pos(begin);
+  char *end(begin + writer.capacity());
+  if (binary) {
+    mvs::orderbook::FeedHeader header;
+    memcpy(header.magic, mvs::orderbook::feedMagic(), sizeof(header.magic));
+    header.version = mvs::orderbook::FeedHeader::currentVersion;
+    header.reserved = 0;
+    memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+  }
+  for (uint64_t n = 0; n < count; ++n) {
+    const mvs::orderbook::Message message(workload.next());
+    if (binary) {
+      const mvs::orderbook::Record record(mvs::orderbook::toRecord(message));
+      memcpy(pos, &record, sizeof(record));
+      pos += sizeof(record);
+    } else {
+      pos += formatLine(message, symbol, pos);
+    }
+    if (static_cast<std::size_t>(end - pos) < maxLine) {
+      writer.release(pos - begin);
+      pos = begin = writer.acquire();
+      end = begin + writer.capacity();
+    }
+  }
+  writer.release(pos - begin);
+  return writer.error();
+}
+
+} // namespace
+
+// writes a synthetic input file, text or a binary feed, of as many messages
+// as it's asked for. See Workload.h for what the options do.
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " output-file [messages=N] [format=text|binary]"
+                 " [pattern=flow|genr] [seed=N] [symbols=N] [skew=R]"
+                 " [walk=R] [depth=R] [cancels=R] [modifies=R]"
+                 " [aggressive=R] [immediates=R] [bursts=R] [burst=N]"
+                 " [backbias=R]"
+                 " [resting=N]"
+              << std::endl;
+    return 1;
+  }
+  uint64_t messages(1000000);
+  std::string format("text");
+  std::string pattern("flow");
+  mvs::orderbook::WorkloadOptions options;
+  for (int i = 2; i < argc; ++i) {
+    const char *value(strchr(argv[i], '='));
+    if (nullptr == value) {
+      std::cerr << "don't know " << argv[i] << std::endl;
+      return 1;
+    }
+    const std::string name(argv[i], value - argv[i]);
+    ++value;
+    if ("messages" == name) {
+      messages = strtoull(value, nullptr, 10);
+    } else if ("format" == name) {
+      format = value;
+    } else if ("pattern" == name) {
+      pattern = value;
+    } else if ("seed" == name) {
+      options.seed = strtoull(value, nullptr, 10);
+    } else if ("symbols" == name) {
+      options.symbols = strtoul(value, nullptr, 10);
+    } else if ("skew" == name) {
+      options.skew = strtod(value, nullptr);
+    } else if ("walk" == name) {
+      options.walk = strtod(value, nullptr);
+    } else if ("depth" == name) {
+      options.depth = strtod(value, nullptr);
+    } else if ("cancels" == name) {
+      options.cancels = strtod(value, nullptr);
+    } else if ("modifies" == name) {
+      options.modifies = strtod(value, nullptr);
+    } else if ("aggressive" == name) {
+      options.aggressive = strtod(value, nullptr);
+    } else if ("immediates" == name) {
+      options.immediates = strtod(value, nullptr);
+    } else if ("bursts" == name) {
+      options.bursts = strtod(value, nullptr);
+    } else if ("burst" == name) {
+      options.burst = strtoul(value, nullptr, 10);
+    } else if ("backbias" == name) {
+      options.backBias = strtod(value, nullptr);
+    } else if ("resting" == name) {
+      options.resting = strtoul(value, nullptr, 10);
+    } else {
+      std::cerr << "don't know " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (0u == options.symbols || options.symbols > 65536u ||
+      0.0 >= options.depth || options.depth > 1.0) {
+    std::cerr << "symbols go from 1 to 65536, depth from 0 to 1" << std::endl;
+    return 1;
+  }
+
+  const int fd(::open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd < 0) {
+    std::cerr << "can't write " << argv[1] << std::endl;
+    return 1;
+  }
+  const bool binary("binary" == format);
+  int error(0);
+  if ("genr" == pattern) {
+    mvs::orderbook::GenRWorkload workload(options.seed);
+    error = generate(workload, messages, binary, false, fd);
+  } else {
+    mvs::orderbook::Workload workload(options);
+    error = generate(workload, messages, binary, options.symbols > 1, fd);
+  }
+  if (0 != ::close(fd) && 0 == error) {
+    error = errno;
+  }
+  if (0 != error) {
+    std::cerr << "failed writing " << argv[1] << ": " << strerror(error)
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include <cinttypes>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "../Actions.h"
+#include "../BookManager.h"
+#include "../BookState.h"
+#include "../Enums.h"
+#include "../Exceptions.h"
+#include "../Journal.h"
+#include "../MappedFile.h"
+#include "../OrderBook.h"
+#include "../Processor.h"
+
+// rebuilds the books from a journal main wrote, starting from a saved state
+// if there is one, and checks the trades coming out of them are the ones that
+// were journaled. The books can be saved, for main to restore and go on with
+// the input from where the journal ends.
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " journal-file [restore=state-file]"
+                 " [checkpoint=state-file] [print]"
+              << std::endl;
+    return 1;
+  }
+  const char *restore(nullptr);
+  const char *checkpoint(nullptr);
+  bool print(false);
+  for (int i = 2; i < argc; ++i) {
+    if (strncmp("restore=", argv[i], 8) == 0) {
+      restore = argv[i] + 8;
+    } else if (strncmp("checkpoint=", argv[i], 11) == 0) {
+      checkpoint = argv[i] + 11;
+    } else if (strncmp("print", argv[i], 5) == 0) {
+      print = true;
+    }
+  }
+
+  using BooksT = mvs::orderbook::BookManager<mvs::orderbook::OrderBook>;
+  BooksT books(1);
+  mvs::orderbook::Processor<BooksT> processor(books);
+
+  uint64_t offset(0);
+  if (nullptr != restore) {
+    try {
+      mvs::orderbook::MappedFile saved(restore);
+      const mvs::orderbook::BookState state(saved.data(), saved.size());
+      offset = mvs::orderbook::restoreState(books, state);
+    } catch (const std::system_error &e) {
+      std::cerr << "can't restore " << restore << ": " << e.code().message()
+                << std::endl;
+      return 1;
+    } catch (const mvs::orderbook::OrderBookError &e) {
+      std::cerr << "can't restore " << restore << ": " << e.what()
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // the reader points into the mapping, so they're kept together
+  std::unique_ptr<mvs::orderbook::MappedFile> input;
+  std::unique_ptr<mvs::orderbook::JournalReader> reader;
+  try {
+    input.reset(new mvs::orderbook::MappedFile(argv[1]));
+    reader.reset(
+        new mvs::orderbook::JournalReader(input->data(), input->size()));
+  } catch (const std::system_error &e) {
+    std::cerr << "can't read " << argv[1] << ": " << e.code().message()
+              << std::endl;
+    return 1;
+  } catch (const mvs::orderbook::OrderBookError &e) {
+    std::cerr << "can't read " << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  const mvs::orderbook::JournalReader &journal(*reader);
+
+  uint64_t messages(0);
+  uint64_t trades(0);
+  uint64_t mismatches(0);
+  uint64_t errors(0);
+  // the last message's sequence, i.e. how far the input got
+  uint64_t sequence(offset);
+
+  // the trades the last message made, to be checked against the ones that
+  // follow it in the journal
+  std::vector<std::string> made;
+  std::size_t checked(0);
+  auto cb = [&made](const mvs::orderbook::Trade &trade) {
+    std::ostringstream os;
+    os << trade;
+    made.push_back(os.str());
+  };
+  // whatever the last message made that wasn't journaled
+  auto unchecked = [&] {
+    mismatches += made.size() - checked;
+    made.clear();
+    checked = 0;
+  };
+
+  for (const mvs::orderbook::JournalEntry &entry : journal) {
+    if (entry.sequence <= offset) {
+      // already in the saved state
+      continue;
+    }
+    if (mvs::orderbook::tradeEntry == entry.record.action) {
+      ++trades;
+      std::ostringstream os;
+      os << mvs::orderbook::toTrade(entry);
+      if (checked < made.size() && made[checked] == os.str()) {
+        ++checked;
+      } else {
+        ++mismatches;
+      }
+      continue;
+    }
+    unchecked();
+    ++messages;
+    sequence = entry.sequence;
+    if (mvs::orderbook::Result::Ok !=
+        processor.process(mvs::orderbook::toMessage(entry.record), cb)) {
+      ++errors;
+    }
+  }
+  // the last message's trades may not have made it into the journal before
+  // we went down, which doesn't make them wrong
+  const uint64_t missing(made.size() - checked);
+
+  if (print) {
+    books.forEach([](uint16_t symbol, const mvs::orderbook::OrderBook &book) {
+      std::cout << "symbol " << symbol << book;
+    });
+  }
+  std::cout << messages << " messages after line " << offset << ", up to line "
+            << sequence << std::endl;
+  std::cout << trades << " trades" << std::endl;
+  std::cout << errors << " rejected messages" << std::endl;
+  std::cout << mismatches << " trades that don't match the journal"
+            << std::endl;
+  if (0u != missing) {
+    std::cout << missing << " trades of the last message weren't journaled"
+              << std::endl;
+  }
+  if (0u != journal.torn()) {
+    std::cout << "left out " << journal.torn()
+              << " bytes of an entry that was being written" << std::endl;
+  }
+
+  if (nullptr != checkpoint) {
+    try {
+      mvs::orderbook::saveState(checkpoint, books, sequence);
+    } catch (const std::system_error &e) {
+      std::cerr << "failed writing " << e.what() << std::endl;
+      return 1;
+    }
+  }
+  return 0 == mismatches ? 0 : 2;
+}